@@ -22,16 +22,23 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include <limits.h>
+#include <time.h>
 
 #if defined(_WIN32) || defined(_WIN64)
    #define WIN32_LEAN_AND_MEAN
    #include <windows.h>
    #include <shlwapi.h>
 #elif defined(__APPLE__) || defined(__unix__)
+   #include <errno.h>
    #include <unistd.h>
    #include <dirent.h>
+   #include <fcntl.h>
+   #include <pthread.h>
+   #include <sys/mman.h>
    #include <sys/stat.h>
    #include <sys/param.h>
+   #include <utime.h>
 #endif
 
 #include "lua.h"
@@ -48,8 +55,24 @@
 #define BRUTUS_VERSION "1.0.0"
 
 #define BRUT_FILE "brut.dat"
-#define BRUT_FILE_MAJOR 1
-#define BRUT_FILE_MINOR 1
+#define BRUT_CACHE_DIR ".brut-cache"
+#define BRUT_CACHE_MAX_AGE (7 * 24 * 60 * 60)
+#define BRUT_FILE_MAJOR 2
+#define BRUT_FILE_MINOR 7
+#define BRUT_FILE_LEGACY_MAJOR 1
+#define BRUT_FILE_LEGACY_MINOR 1
+#define BRUT_FILE_HEADER_SIZE 16
+#define BRUT_FILE_INDEX_ENTRY_SIZE 24
+#define BRUT_FILE_PAGE_SIZE 4096
+#define BRUT_FILE_DICT_SIZE (16 * 1024)
+#define BRUT_FILE_DICT_SAMPLE_SIZE (2 * 1024 * 1024)
+#define BRUT_FILE_SOLID_BLOCK_SIZE (256 * 1024)
+#define BRUT_FILE_MAX_SOLID_BLOCKS 256
+#define BRUT_FILE_SPLIT_SIZE (128 * 1024)
+#define BRUT_FILE_MIN_HUFFMAN_GAIN 32
+#define BRUT_FILE_MIN_SPEED_GAIN 8
+#define BRUT_EXE_MAGIC "brutexe\0"
+#define BRUT_EXE_TRAILER_SIZE 16
 #define BRUT_FILE_MIN_COMPRESS_SIZE 16
 #define BRUT_FILE_CUSTOM_DATA "jit 2.1\0"
 
@@ -78,42 +101,65 @@
    #error "Unsupported architecture"
 #endif
 
+#include "base64_simd.c"
 #include "base64.c"
 #include "fastlz.c"
+#include "huffman.c"
 #include "util.c"
+#include "bytecode.c"
 
 #include "lib_brutus.c"
 
-static char* LoadBrutFile(const char*, int* out_len);
-static bool CreateBrutFile(const char*);
-static char* GetChunk(const char*, int*);
-static int LuaLoadChunkFromBundle(lua_State*);
-
-const char* LUA_REQUIRE_OVERLOAD_SOURCE =
-   "local __require = require\n"
-   "require = function(name)\n"
-   "  if package.loaded[name] ~= nil then\n"
-   "     return package.loaded[name]\n"
-   "  end\n"
-   "  local chunk = ___loadchunkfrombundle___(name)\n"
-   "  if chunk ~= nil then\n"
-   "     local loader = loadstring(chunk)\n"
-   "     package.preload[name] = loader\n"
-   "     package.loaded[name]  = loader()\n"
-   "     return package.loaded[name]\n"
-   "  end\n"
-   "  return __require(name)\n"
-   "end"
-;
+static const char* LoadBrutFile(const char*, int* out_len);
+static bool LoadBrutBundle(const char*, unsigned int);
+static bool FindExeBundle(const char*, unsigned int, unsigned int*, unsigned int*);
+static bool CreateBrutFile(const char*, bool, bool, bool, bool);
+static const char* GetChunk(const char*, int*);
+static bool PreloadChunks(int, bool);
+static void OpenBundleLoader(lua_State*);
 
 #define __BRUT_RUN_TESTS 0
 #if __BRUT_RUN_TESTS
    #include "test_runner.c"
 #endif
 
-dyn_array_t(char*) MODULES = 0;
-dyn_array_t(char*) CHUNKS  = 0;
-dyn_array_t(int)   LENGTHS = 0;
+enum {
+   BRUT_CHUNK_FLAG_COMPRESSED = 1 << 0,
+   BRUT_CHUNK_FLAG_DICTIONARY = 1 << 1,
+   BRUT_CHUNK_FLAG_SOLID      = 1 << 2,
+   BRUT_CHUNK_FLAG_BLOCK      = 1 << 3,
+   BRUT_CHUNK_FLAG_SPLIT      = 1 << 4,
+   BRUT_CHUNK_FLAG_HUFFMAN    = 1 << 5,
+   BRUT_CHUNK_FLAG_BYTECODE   = 1 << 6,
+};
+
+enum {
+   BRUT_CHUNK_PENDING,
+   BRUT_CHUNK_LOADING,
+   BRUT_CHUNK_READY,
+   BRUT_CHUNK_FAILED,
+};
+
+typedef struct {
+   unsigned char flags;
+   bool          encoded;
+   const char*   payload;
+   int           payload_len;
+   int           raw_len;
+   const char*   dict;
+   int           dict_len;
+   int           block;
+   int           block_off;
+   int           state;
+} BrutEntry;
+
+dyn_array_t(char*)       MODULES = 0;
+dyn_array_t(const char*) CHUNKS  = 0;
+dyn_array_t(int)         LENGTHS = 0;
+dyn_array_t(BrutEntry)   INDEX   = 0;
+
+// maps module names to their slot in the arrays above
+struct { char* key; int value; }* LOOKUP = 0;
 
 int
 main(int argc, char* argv[])
@@ -122,9 +168,37 @@ main(int argc, char* argv[])
    if (argc > 0)
       { exe_name = argv[0]; }
 
-   // process command line arguments
+   // use the fastest base64 decoder this cpu supports
+   InitBase64Kernel();
+
+   // shipped executables carry their bundle at the end of their own image
+   char* exe_path = GetExePath();
+
+   int image_len = 0;
+   const char* image = exe_path ? MapEntireFile(exe_path, &image_len) : 0;
+
+   unsigned int bundle_off = 0;
+   unsigned int bundle_len = 0;
+
+   bool embedded = image && FindExeBundle(image, image_len, &bundle_off, &bundle_len);
+   if (image && !embedded)
+      { UnmapEntireFile(image, image_len); }
+
+   // process command line arguments,
+   // shipped executables pass all of them to the app.
    bool ship = false;
-   while (argc > 0) {
+   bool ship_solid = false;
+   bool ship_speed = false;
+   bool ship_cache = true;
+   const char* ship_exe = 0;
+   int threads = -1; // picked once the bundle is loaded
+
+   if (embedded) {
+      argc -= 1;
+      argv += 1;
+   }
+
+   while (argc > 0 && !embedded) {
       int len = strlen(argv[0]);
 
    #if __BRUT_RUN_TESTS
@@ -134,13 +208,53 @@ main(int argc, char* argv[])
    #endif
 
       if (strncmp(argv[0], "-h", len) == 0) {
-         printf("brutus version %s (%d.%d)\n   usage: %s [-h] -- <args>\n", BRUTUS_VERSION, BRUT_FILE_MINOR, BRUT_FILE_MAJOR, exe_name);
+         printf("brutus version %s (%d.%d)\n   usage: %s [-h] [-j threads (0 decodes on require)] [ship [--exe name] [--solid] [--optimize=size|speed] [--no-cache]] -- <args>\n", BRUTUS_VERSION, BRUT_FILE_MAJOR, BRUT_FILE_MINOR, exe_name);
          return 0;
       }
 
       if (strncmp(argv[0], "ship", len) == 0)
          { ship = true; }
 
+      // ship a single executable with the bundle appended to it
+      if (strcmp(argv[0], "--exe") == 0 && argc > 1) {
+         ship_exe = argv[1];
+         argc -= 1;
+         argv += 1;
+      }
+
+      // compress modules together in a few large blocks
+      if (strcmp(argv[0], "--solid") == 0)
+         { ship_solid = true; }
+
+      // pick codecs for the smallest bundle, or the fastest loading one
+      if (strncmp(argv[0], "--optimize=", 11) == 0) {
+         const char* goal = argv[0] + 11;
+         if (strcmp(goal, "speed") == 0)
+            { ship_speed = true; }
+         else if (strcmp(goal, "size") == 0)
+            { ship_speed = false; }
+         else {
+            Log("unknown optimization goal '%s'", goal);
+            return 1;
+         }
+      }
+
+      // compile and compress every module, even if it's cached
+      if (strcmp(argv[0], "--no-cache") == 0)
+         { ship_cache = false; }
+
+      // decode the bundle in the background using the given number
+      // of threads instead of one less than the processor count, 0
+      // decodes every chunk when it's first required.
+      if (strncmp(argv[0], "-j", len) == 0 && argc > 1) {
+         threads = atoi(argv[1]);
+         if (threads < 0)
+            { threads = 0; }
+
+         argc -= 1;
+         argv += 1;
+      }
+
       if (strncmp(argv[0], "--", len) == 0) {
          argc -= 1;
          argv += 1;
@@ -153,16 +267,16 @@ main(int argc, char* argv[])
 
    // if 'ship' was passed we should create a brut file rather than run one.
    if (ship) {
-      if (!CreateBrutFile(BRUT_FILE)) {
-         Log("unable to create %s", BRUT_FILE);
+      const char* output = ship_exe ? ship_exe : BRUT_FILE;
+      if (!CreateBrutFile(output, ship_exe != 0, ship_solid, ship_speed, ship_cache)) {
+         Log("unable to create %s", output);
          return 2;
       }
 
-      Log("wrote %s", BRUT_FILE);
+      Log("wrote %s", output);
       return 0;
    }
 
-   char* exe_path = GetExePath();
    #if defined(PLATFORM_WINDOWS)
       char path_sep = '\\';
    #else
@@ -182,10 +296,10 @@ main(int argc, char* argv[])
    }
 
    lua_State* L = luaL_newstate();
-   bool bundled = FileExists(BRUT_FILE);
+   bool bundled = embedded || FileExists(BRUT_FILE);
 
-   char* chunk   = 0;
-   int chunk_len = 0;
+   const char* chunk = 0;
+   int chunk_len     = 0;
 
    // setup the runtime and open all extension libraries
    {
@@ -193,22 +307,31 @@ main(int argc, char* argv[])
       OpenBrutusLib(L, bundled);
    }
 
-   // try to load brut.dat or main.lua
+   // try to load the embedded bundle, brut.dat or main.lua
    if (bundled) {
-      chunk = LoadBrutFile(BRUT_FILE, &chunk_len);
+      if (!embedded)
+         { chunk = LoadBrutFile(BRUT_FILE, &chunk_len); }
+      else if (LoadBrutBundle(&image[bundle_off], bundle_len))
+         { chunk = GetChunk("main", &chunk_len); }
+
+      // the entrypoint is already decoded, everything else is
+      // decoded while it runs. the entrypoint's thread is left
+      // free unless there's only one processor.
+      if (threads < 0) {
+         threads = GetProcessorCount() - 1;
+         if (threads < 1)
+            { threads = 1; }
+      }
 
-      // if we're in a bundled context, overload 'require' to look
-      // for modules contained within the bundle.
-      lua_pushcclosure(L, LuaLoadChunkFromBundle, 1);
-      lua_setfield(L, LUA_GLOBALSINDEX, "___loadchunkfrombundle___");
+      if (chunk && threads > 0 && stbds_arrlen(INDEX) > 1)
+         { PreloadChunks(threads, false); }
 
-      luaL_loadstring(L, LUA_REQUIRE_OVERLOAD_SOURCE);
-      lua_call(L, 0, 0);
+      // if we're in a bundled context, let 'require' look
+      // for modules contained within the bundle.
+      OpenBundleLoader(L);
    }
    else {
-      chunk = ReadEntireFile("main.lua");
-      if (chunk)
-         { chunk_len = strlen(chunk); }
+      chunk = ReadEntireFile("main.lua", &chunk_len);
    }
 
 
@@ -254,171 +377,1074 @@ cleanup:
 }
 
 static int
-LuaLoadChunkFromBundle(lua_State* l)
+LuaBundleLoader(lua_State* l)
 {
-   int top = lua_gettop(l);
-   if (!lua_isstring(l, top)) {
-      lua_pushnil(l);
-      return 1;
-   }
-
-   const char* module = lua_tostring(l, top);
+   const char* module = luaL_checkstring(l, 1);
 
    int chunk_len = 0;
-   char* chunk = GetChunk(module, &chunk_len);
+   const char* chunk = GetChunk(module, &chunk_len);
    if (!chunk || chunk_len == 0) {
-      lua_pushnil(l);
+      lua_pushfstring(l, "\n\tno module '%s' in " BRUT_FILE, module);
       return 1;
    }
 
-   lua_pushlstring(l, chunk, chunk_len);
+   // the chunk is loaded straight from bundle memory
+   if (luaL_loadbuffer(l, chunk, chunk_len, module) != 0)
+      { return luaL_error(l, "error loading module '%s' from " BRUT_FILE ":\n\t%s", module, lua_tostring(l, -1)); }
+
    return 1;
 }
 
-static char*
+static void
+OpenBundleLoader(lua_State* l)
+{
+   lua_getfield(l, LUA_GLOBALSINDEX, "package");
+   lua_getfield(l, -1, "loaders");
+
+   // bundled modules are searched right after package.preload,
+   // before anything on disk.
+   for (int i = lua_objlen(l, -1); i >= 2; i -= 1) {
+      lua_rawgeti(l, -1, i);
+      lua_rawseti(l, -2, i + 1);
+   }
+
+   lua_pushcfunction(l, LuaBundleLoader);
+   lua_rawseti(l, -2, 2);
+
+   lua_pop(l, 2);
+}
+
+static bool EnsureChunk(int);
+
+static const char*
 GetChunk(const char* module, int* out_len)
 {
-   int len = strlen(module);
-   for (int i = 0; i < stbds_arrlen(MODULES); i += 1) {
-      if (strncmp(module, MODULES[i], len) == 0) {
-         *out_len = LENGTHS[i];
-         return CHUNKS[i];
+   int i = stbds_shgeti(LOOKUP, module);
+   if (i < 0)
+      { return 0; }
+
+   i = LOOKUP[i].value;
+
+   // chunks are only decoded the first time they're requested.
+   if (!EnsureChunk(i))
+      { return 0; }
+
+   *out_len = LENGTHS[i];
+   return CHUNKS[i];
+}
+
+static bool
+LoadChunk(int i)
+{
+   BrutEntry* entry = &INDEX[i];
+
+   // solid modules point into the decompressed data of their block
+   if ((entry->flags & BRUT_CHUNK_FLAG_SOLID) == BRUT_CHUNK_FLAG_SOLID) {
+      if (!EnsureChunk(entry->block)) {
+         Log("failed to load block for entry '%s'", MODULES[i]);
+         return false;
       }
+
+      CHUNKS[i]  = CHUNKS[entry->block] + entry->block_off;
+      LENGTHS[i] = entry->raw_len;
+      return true;
    }
 
-   return 0;
+   const char* payload = entry->payload;
+   int payload_len = entry->payload_len;
+
+   char* decoded = 0;
+   if (entry->encoded) {
+      decoded = Decode(payload, payload_len, &payload_len);
+      if (!decoded) {
+         Log("failed to decode entry '%s'", MODULES[i]);
+         return false;
+      }
+
+      payload = decoded;
+   }
+
+   bool split   = (entry->flags & BRUT_CHUNK_FLAG_SPLIT) == BRUT_CHUNK_FLAG_SPLIT;
+   bool entropy = (entry->flags & BRUT_CHUNK_FLAG_HUFFMAN) == BRUT_CHUNK_FLAG_HUFFMAN;
+
+   // entropy coded payloads are decoded before they're decompressed,
+   // split payloads do this for each of their blocks.
+   if (entropy && !split) {
+      int decoded_len = HuffmanDecodedSize(payload, payload_len);
+      decoded = decoded_len > 0 ? malloc(decoded_len) : 0;
+      if (!decoded || !HuffmanDecode(payload, payload_len, decoded, decoded_len)) {
+         Log("failed to decode entry '%s'", MODULES[i]);
+         free(decoded);
+         return false;
+      }
+
+      payload = decoded;
+      payload_len = decoded_len;
+   }
+
+   const char* chunk = 0;
+   int chunk_len = payload_len;
+
+   if (split) {
+      // large chunks are decompressed a block per thread
+      chunk = DecompressBlocks(payload, payload_len, entry->raw_len, entry->dict, entry->dict_len, entropy, GetProcessorCount(), &chunk_len);
+      if (!chunk) {
+         Log("failed to decompress entry '%s' (%d)", MODULES[i], payload_len);
+         return false;
+      }
+   }
+   else if ((entry->flags & BRUT_CHUNK_FLAG_COMPRESSED) == BRUT_CHUNK_FLAG_COMPRESSED) {
+      chunk = Decompress(payload, payload_len, entry->raw_len, entry->dict, entry->dict_len, &chunk_len);
+      free(decoded);
+
+      if (!chunk) {
+         Log("failed to decompress entry '%s' (%d)", MODULES[i], payload_len);
+         return false;
+      }
+   }
+   else {
+      // uncompressed chunks are used directly from the bundle,
+      // or own their decoded payload if it was base64 encoded.
+      chunk = payload;
+   }
+
+   // split bytecode is joined back into a regular dump
+   if ((entry->flags & BRUT_CHUNK_FLAG_BYTECODE) == BRUT_CHUNK_FLAG_BYTECODE) {
+      int joined_len = 0;
+      char* joined = JoinBytecode(chunk, chunk_len, &joined_len);
+      if (chunk != entry->payload)
+         { free((char*)chunk); }
+
+      if (!joined) {
+         Log("failed to join bytecode for entry '%s'", MODULES[i]);
+         return false;
+      }
+
+      chunk = joined;
+      chunk_len = joined_len;
+   }
+
+   CHUNKS[i]  = chunk;
+   LENGTHS[i] = chunk_len;
+   return true;
 }
 
-enum {
-   BRUT_CHUNK_FLAG_COMPRESSED = 1 << 0,
-};
+// guards the state of every entry in INDEX
+Mutex CHUNK_LOCK  = MUTEX_INIT;
+Cond  CHUNK_READY = COND_INIT;
+int   PRELOAD_NEXT = 0;
 
-static char*
-LoadBrutFile(const char* path, int* out_len)
+// decodes chunk i on the calling thread unless another thread already
+// has, in which case this only waits for that one chunk to be ready.
+static bool
+EnsureChunk(int i)
 {
-   char* datfile = ReadEntireFile(path);
-   if (!datfile)
-      { return 0; }
+   BrutEntry* entry = &INDEX[i];
+
+   LockMutex(&CHUNK_LOCK);
+   while (entry->state == BRUT_CHUNK_LOADING)
+      { WaitCond(&CHUNK_READY, &CHUNK_LOCK); }
+
+   if (entry->state != BRUT_CHUNK_PENDING) {
+      bool ready = entry->state == BRUT_CHUNK_READY;
+      UnlockMutex(&CHUNK_LOCK);
+      return ready;
+   }
+
+   entry->state = BRUT_CHUNK_LOADING;
+   UnlockMutex(&CHUNK_LOCK);
+
+   bool ok = LoadChunk(i);
+
+   LockMutex(&CHUNK_LOCK);
+   entry->state = ok ? BRUT_CHUNK_READY : BRUT_CHUNK_FAILED;
+   BroadcastCond(&CHUNK_READY);
+   UnlockMutex(&CHUNK_LOCK);
+
+   return ok;
+}
+
+static void
+PreloadWorker(void* data)
+{
+   // each worker claims the next chunk in the index, chunks
+   // always land in their own slot so the order is stable.
+   while (true) {
+      LockMutex(&CHUNK_LOCK);
+      int i = PRELOAD_NEXT;
+      PRELOAD_NEXT += 1;
+      UnlockMutex(&CHUNK_LOCK);
+
+      if (i >= stbds_arrlen(INDEX))
+         { break; }
+
+      EnsureChunk(i);
+   }
+}
+
+// decodes every chunk on the given number of threads. unless told to
+// wait, this happens in the background so the entrypoint can run while
+// the rest of the bundle is decoded.
+static bool
+PreloadChunks(int threads, bool wait)
+{
+   LockMutex(&CHUNK_LOCK);
+   PRELOAD_NEXT = 0;
+   UnlockMutex(&CHUNK_LOCK);
+
+   dyn_array_t(Thread) workers = 0;
+   for (int i = wait ? 1 : 0; i < threads; i += 1) {
+      Thread thread;
+      if (!StartThread(&thread, PreloadWorker, 0))
+         { break; }
 
+      stbds_arrput(workers, thread);
+   }
+
+   if (!wait) {
+      for (int i = 0; i < stbds_arrlen(workers); i += 1)
+         { DetachThread(workers[i]); }
+
+      stbds_arrfree(workers);
+      return true;
+   }
+
+   // the calling thread does its share of the work too
+   PreloadWorker(0);
+
+   for (int i = 0; i < stbds_arrlen(workers); i += 1)
+      { JoinThread(workers[i]); }
+
+   stbds_arrfree(workers);
+
+   for (int i = 0; i < stbds_arrlen(INDEX); i += 1) {
+      if (INDEX[i].state != BRUT_CHUNK_READY)
+         { return false; }
+   }
+
+   return true;
+}
+
+static bool
+LoadBrutIndex(const char* datfile, unsigned int len, int total_chunks, int minor)
+{
+   int first = stbds_arrlen(INDEX);
+
+   unsigned int off = BRUT_FILE_HEADER_SIZE;
+   if (off + 4 > len)
+      { return false; }
+
+   unsigned short entry_size = ReadU16(&datfile[off]);
+   off += 4;
+
+   // 2.3 added a dictionary shared by every chunk
+   const char* dict = 0;
+   unsigned int dict_len = 0;
+
+   if (minor >= 3) {
+      if (off + 8 > len)
+         { return false; }
+
+      unsigned int dict_off = ReadU32(&datfile[off]);
+      dict_len = ReadU32(&datfile[off + 4]);
+      off += 8;
+
+      if (dict_off > len || dict_len > len - dict_off)
+         { return false; }
+
+      dict = &datfile[dict_off];
+   }
+
+   // 2.1 entries don't have an uncompressed size
+   if (entry_size < 20 || (unsigned long long)total_chunks * entry_size > len - off)
+      { return false; }
+
+   // only the index is read up front, payloads are
+   // decoded when their chunk is first requested.
+   // the first 4 bytes of each entry are reserved. older
+   // files store an fnv-1a name hash there, it's skipped
+   // as names are looked up through LOOKUP instead.
+   for (int i = 0; i < total_chunks; i += 1) {
+      const char* ent = &datfile[off];
+      off += entry_size;
+
+      unsigned int   name_off    = ReadU32(&ent[4]);
+      unsigned short name_len    = ReadU16(&ent[8]);
+      unsigned char  flags       = (unsigned char)ent[10];
+      unsigned int   payload_off = ReadU32(&ent[12]);
+      unsigned int   payload_len = ReadU32(&ent[16]);
+      unsigned int   raw_len     = entry_size >= 24 ? ReadU32(&ent[20]) : 0;
+
+      if (name_off > len || name_len > len - name_off)
+         { return false; }
+
+      unsigned char supported = BRUT_CHUNK_FLAG_COMPRESSED | BRUT_CHUNK_FLAG_DICTIONARY | BRUT_CHUNK_FLAG_BLOCK | BRUT_CHUNK_FLAG_SPLIT | BRUT_CHUNK_FLAG_HUFFMAN | BRUT_CHUNK_FLAG_BYTECODE;
+      if ((flags & BRUT_CHUNK_FLAG_SOLID) == BRUT_CHUNK_FLAG_SOLID)
+         { supported = BRUT_CHUNK_FLAG_SOLID; }
+
+      if ((flags & ~supported) != 0) {
+         Log("unsupported flags %d for entry %d", flags, i);
+         return false;
+      }
+
+      BrutEntry entry = {0};
+      entry.flags = flags;
+
+      // 2.4 added solid blocks, modules in a block store their
+      // offset and size within its decompressed data instead.
+      if ((flags & BRUT_CHUNK_FLAG_SOLID) == BRUT_CHUNK_FLAG_SOLID) {
+         int block = (unsigned char)ent[11];
+         if (block >= i || (INDEX[first + block].flags & BRUT_CHUNK_FLAG_BLOCK) == 0)
+            { return false; }
+
+         unsigned int block_len = INDEX[first + block].raw_len;
+         if (payload_off > block_len || raw_len > block_len - payload_off)
+            { return false; }
+
+         entry.block     = first + block;
+         entry.block_off = payload_off;
+         entry.raw_len   = raw_len;
+      }
+      else {
+         if (payload_off > len || payload_len > len - payload_off)
+            { return false; }
+
+         // split payloads are always compressed and decompress to a known size
+         if ((flags & BRUT_CHUNK_FLAG_SPLIT) == BRUT_CHUNK_FLAG_SPLIT) {
+            if ((flags & BRUT_CHUNK_FLAG_COMPRESSED) == 0 || raw_len == 0)
+               { return false; }
+         }
+
+         // only compressed payloads are entropy coded
+         if ((flags & BRUT_CHUNK_FLAG_HUFFMAN) == BRUT_CHUNK_FLAG_HUFFMAN) {
+            if ((flags & BRUT_CHUNK_FLAG_COMPRESSED) == 0)
+               { return false; }
+         }
+
+         // blocks need their size up front to bound the modules in them
+         if ((flags & BRUT_CHUNK_FLAG_BLOCK) == BRUT_CHUNK_FLAG_BLOCK) {
+            bool compressed = (flags & BRUT_CHUNK_FLAG_COMPRESSED) == BRUT_CHUNK_FLAG_COMPRESSED;
+            if (raw_len == 0 || (!compressed && raw_len != payload_len))
+               { return false; }
+         }
+
+         entry.payload     = &datfile[payload_off];
+         entry.payload_len = payload_len;
+         entry.raw_len     = raw_len;
+      }
+
+      if ((flags & BRUT_CHUNK_FLAG_DICTIONARY) == BRUT_CHUNK_FLAG_DICTIONARY) {
+         if (!dict_len)
+            { return false; }
+
+         entry.dict     = dict;
+         entry.dict_len = dict_len;
+      }
+
+      stbds_arrput(MODULES, CopyStringLen(&datfile[name_off], name_len));
+      stbds_arrput(CHUNKS, 0);
+      stbds_arrput(LENGTHS, 0);
+      stbds_arrput(INDEX, entry);
+   }
+
+   return true;
+}
+
+static bool
+LoadBrutEntries(const char* datfile, unsigned int len, int total_chunks, bool legacy)
+{
+   unsigned int off = BRUT_FILE_HEADER_SIZE;
+
+   // files without an index are walked sequentially to build one,
+   // their payloads are still decoded on demand.
+   for (int i = 0; i < total_chunks; i += 1) {
+      const char* name = 0;
+      int name_len = 0;
+
+      if (legacy) {
+         const char* end = memchr(&datfile[off], '\0', len - off);
+         if (!end)
+            { return false; }
+
+         name = &datfile[off];
+         name_len = end - name;
+         off += name_len + 1;
+      }
+      else {
+         if (off + 2 > len)
+            { return false; }
+
+         name_len = ReadU16(&datfile[off]);
+         off += 2;
+
+         name = &datfile[off];
+         off += name_len;
+      }
+
+      if (off + 5 > len)
+         { return false; }
+
+      unsigned char flags = (unsigned char)datfile[off];
+      off += 1;
+
+      unsigned int entry_length = ReadU32(&datfile[off]);
+      off += 4;
+
+      if (entry_length > len - off)
+         { return false; }
+
+      if ((flags & ~BRUT_CHUNK_FLAG_COMPRESSED) != 0) {
+         Log("unsupported flags %d for entry %d", flags, i);
+         return false;
+      }
+
+      BrutEntry entry = {0};
+      entry.flags       = flags;
+      entry.encoded     = legacy;
+      entry.payload     = &datfile[off];
+      entry.payload_len = entry_length;
+
+      stbds_arrput(MODULES, CopyStringLen(name, name_len));
+      stbds_arrput(CHUNKS, 0);
+      stbds_arrput(LENGTHS, 0);
+      stbds_arrput(INDEX, entry);
+
+      off += entry_length;
+   }
+
+   return true;
+}
+
+static bool
+LoadBrutBundle(const char* datfile, unsigned int len)
+{
    // check the magic number
-   int len = strlen(datfile);
-   if (len < 4 || strncmp(datfile, "brut", 4) != 0) {
+   if (len < BRUT_FILE_HEADER_SIZE || strncmp(datfile, "brut", 4) != 0) {
       Log("malformed header");
-      return 0;
+      return false;
    }
 
    unsigned int off = 4;
 
-   // ensure version number matches the current runtime
+   // ensure version number is supported by the current runtime.
+   // 2.0 files have no index, 1.1 files also store their payloads
+   // base64 encoded.
    unsigned char major = datfile[off];
    unsigned char minor = datfile[off+1];
-   if (major != BRUT_FILE_MAJOR || minor != BRUT_FILE_MINOR) {
+
+   bool legacy  = major == BRUT_FILE_LEGACY_MAJOR && minor == BRUT_FILE_LEGACY_MINOR;
+   bool indexed = major == BRUT_FILE_MAJOR && minor >= 1 && minor <= BRUT_FILE_MINOR;
+   if (!legacy && !indexed && (major != BRUT_FILE_MAJOR || minor != 0)) {
       Log("unsupported version %d.%d", major, minor);
-      return 0;
+      return false;
    }
 
    off += 2;
 
    // get number of chunks in the file
-   unsigned short total_chunks = *((unsigned short*)&datfile[off]);
+   unsigned short total_chunks = ReadU16(&datfile[off]);
    off += 2;
 
-   char* app_data = &datfile[off];
+   const char* app_data = &datfile[off];
    off += 8;
 
    if (memcmp(app_data, BRUT_FILE_CUSTOM_DATA, 8) != 0) {
       Log("unsupported %s file", BRUT_FILE);
-      return 0;
+      return false;
    }
 
-   // decode and decompress each chunk in the file
-   for (int i = 0; i < total_chunks; i += 1) {
-      char* name = &datfile[off];
-      off += strlen(name) + 1;
+   int first = stbds_arrlen(MODULES);
 
-      unsigned char flags = (unsigned char)datfile[off];
-      off += 1;
+   bool ok = false;
+   if (indexed)
+      { ok = LoadBrutIndex(datfile, len, total_chunks, minor); }
+   else
+      { ok = LoadBrutEntries(datfile, len, total_chunks, legacy); }
 
-      unsigned int entry_length = *((unsigned int*)&datfile[off]);
-      off += 4;
-
-      char* encoded = &datfile[off];
+   if (!ok) {
+      Log("malformed bundle entry");
 
-      int decoded_length = 0;
-      char* decoded = Decode(encoded, entry_length, &decoded_length);
-      if (!decoded) {
-         Log("failed to decode entry %d", i);
-         return 0;
-      }
-
-      char* chunk = decoded;
-      int chunk_len = decoded_length;
+      stbds_arrsetlen(MODULES, first);
+      stbds_arrsetlen(CHUNKS, first);
+      stbds_arrsetlen(LENGTHS, first);
+      stbds_arrsetlen(INDEX, first);
+      return false;
+   }
 
-      if ((flags & BRUT_CHUNK_FLAG_COMPRESSED) == BRUT_CHUNK_FLAG_COMPRESSED) {
-         char* decomp = Decompress(decoded, decoded_length, &chunk_len);
-         if (!decomp) {
-            Log("failed to decompress entry %d (%d, %d)", i, entry_length, decoded_length);
-            return 0;
-         }
+   // solid blocks aren't modules and can't be required
+   for (int i = first; i < stbds_arrlen(MODULES); i += 1) {
+      if ((INDEX[i].flags & BRUT_CHUNK_FLAG_BLOCK) == 0)
+         { stbds_shput(LOOKUP, MODULES[i], i); }
+   }
 
-         chunk = decomp;
-         free(decoded);
-      }
+   return true;
+}
 
-      stbds_arrput(MODULES, CopyString(name));
-      stbds_arrput(CHUNKS, chunk);
-      stbds_arrput(LENGTHS, chunk_len);
+static const char*
+LoadBrutFile(const char* path, int* out_len)
+{
+   int len = 0;
+   const char* datfile = MapEntireFile(path, &len);
+   if (!datfile)
+      { return 0; }
 
-      off += entry_length;
+   if (!LoadBrutBundle(datfile, len)) {
+      Log("unable to load %s", path);
+      UnmapEntireFile(datfile, len);
+      return 0;
    }
 
+   // the bundle stays mapped for the lifetime of the runtime
+   // as uncompressed chunks are loaded directly from it.
+   //
    // the entrypoint chunk will always be called 'main'
    return GetChunk("main", out_len);
 }
 
+// shipped executables end with a trailer pointing back at their bundle:
+// bundle offset (unsigned 32-bit integer)
+// bundle size (unsigned 32-bit integer)
+// magic number (8-byte 'brutexe\0')
+static bool
+FindExeBundle(const char* image, unsigned int len, unsigned int* out_off, unsigned int* out_len)
+{
+   if (len < BRUT_EXE_TRAILER_SIZE)
+      { return false; }
+
+   const char* trailer = &image[len - BRUT_EXE_TRAILER_SIZE];
+   if (memcmp(&trailer[8], BRUT_EXE_MAGIC, 8) != 0)
+      { return false; }
+
+   unsigned int bundle_off = ReadU32(&trailer[0]);
+   unsigned int bundle_len = ReadU32(&trailer[4]);
+   if (bundle_off > len - BRUT_EXE_TRAILER_SIZE || bundle_len > len - BRUT_EXE_TRAILER_SIZE - bundle_off)
+      { return false; }
+
+   *out_off = bundle_off;
+   *out_len = bundle_len;
+   return true;
+}
+
+// each thread that ships modules keeps one of these for all of them, so
+// the compiler and scratch memory are only set up once per thread.
+typedef struct {
+   lua_State*         l;      // created on first use
+   dyn_array_t(char)  dump;
+   Arena              arena;  // reset after every payload
+   unsigned long long target; // see BytecodeTarget, 0 until it's known
+} ShipWorker;
+
+static void
+FreeShipWorkers(ShipWorker* workers, int count)
+{
+   for (int i = 0; i < count; i += 1) {
+      if (workers[i].l)
+         { lua_close(workers[i].l); }
+
+      stbds_arrfree(workers[i].dump);
+      ArenaFree(&workers[i].arena);
+   }
+
+   free(workers);
+}
+
 static int
 BytecodeWriter(lua_State* l, const void* p, size_t len, void* ud)
 {
-   struct { char** buffer; int count; } *data = ud;
-   BufPushLen(data->buffer, (char *)p, (int)len);
-   data->count += len;
+   BufPushLen(ud, (char *)p, (int)len);
    return 0;
 }
 
+// compiles a module using the worker's lua state, which is left empty
+// for the next one.
 static char*
-SourceToBytecode(const char* name, const char* source, int* out_len)
+SourceToBytecode(ShipWorker* worker, const char* name, const char* source, int* out_len)
 {
-   char* buffer = 0;
-   struct { char** buffer; int count; } user_data;
+   if (!worker->l)
+      { worker->l = luaL_newstate(); }
+
+   lua_State* l = worker->l;
+   BufClear(&worker->dump);
 
-   lua_State* l = luaL_newstate();
    if (luaL_loadbuffer(l, source, strlen(source), name) != 0) {
       Log("failed to load '%s.lua'\n   %s", name, lua_tostring(l, -1));
+      lua_settop(l, 0);
       return 0;
    }
 
-   user_data.buffer = &buffer;
-   user_data.count  = 0;
+   bool dumped = lua_dump(l, BytecodeWriter, &worker->dump) == 0;
+   lua_settop(l, 0);
 
-   if (lua_dump(l, BytecodeWriter, &user_data) != 0) {
+   if (!dumped) {
       Log("failed to dump bytecode for '%s.lua'", name);
       return 0;
    }
 
-   *out_len = user_data.count;
+   *out_len = stbds_arrlen(worker->dump);
+   return CopyStringLen(worker->dump, *out_len);
+}
+
+static unsigned int
+PlacePayload(unsigned int* offset, int len)
+{
+   unsigned int page_off = *offset % BRUT_FILE_PAGE_SIZE;
+   if (page_off != 0 && page_off + len > BRUT_FILE_PAGE_SIZE)
+      { *offset += BRUT_FILE_PAGE_SIZE - page_off; }
 
-   lua_close(l);
-   return buffer;
+   unsigned int placed = *offset;
+   *offset += len;
+   return placed;
 }
 
+// compresses a payload, setting the chunk flags that describe how. when
+// optimizing for speed, stages that slow down loading are only used if
+// they save a good amount, otherwise as small as it'll go. the result is
+// in the arena, or is the source itself if it's stored as is.
+static const char*
+CompressPayload(Arena* arena, const char* src, int src_len, const char* dict, int dict_len, bool solid, bool speed, int threads, int* out_len, unsigned char* out_flags)
+{
+   // large payloads are split into blocks so they can be
+   // compressed and decompressed on several threads. solid
+   // blocks are kept whole so matches can reach across them.
+   bool split = !solid && src_len > BRUT_FILE_SPLIT_SIZE;
+
+   bool did_comp = false;
+   int comp_len = 0;
+   const char* comp = 0;
+
+   if (split) {
+      comp = CompressBlocks(arena, src, src_len, BRUT_FILE_SPLIT_SIZE, 0, 0, threads, &comp_len);
+      did_comp = true;
+   }
+   else {
+      comp = Compress(arena, src, src_len, &comp_len, &did_comp);
+   }
+
+   unsigned char chunk_flags = did_comp ? BRUT_CHUNK_FLAG_COMPRESSED : 0;
+   if (split)
+      { chunk_flags |= BRUT_CHUNK_FLAG_SPLIT; }
+
+   // only keep the dictionary version if it's actually smaller
+   if (dict && src_len > BRUT_FILE_MIN_COMPRESS_SIZE) {
+      int dict_comp_len = 0;
+      char* dict_comp = 0;
+
+      if (split)
+         { dict_comp = CompressBlocks(arena, src, src_len, BRUT_FILE_SPLIT_SIZE, dict, dict_len, threads, &dict_comp_len); }
+      else
+         { dict_comp = CompressWithDictionary(arena, src, src_len, dict, dict_len, &dict_comp_len); }
+
+      if (dict_comp_len < comp_len) {
+         comp = dict_comp;
+         comp_len = dict_comp_len;
+         chunk_flags |= BRUT_CHUNK_FLAG_COMPRESSED | BRUT_CHUNK_FLAG_DICTIONARY;
+      }
+   }
+
+   // huffman code the compressed payload if that saves enough
+   // to make up for the extra decoding at load time.
+   if (!speed && (chunk_flags & BRUT_CHUNK_FLAG_COMPRESSED) == BRUT_CHUNK_FLAG_COMPRESSED) {
+      int coded_len = 0;
+      char* coded = 0;
+
+      if (split) {
+         coded = EntropyCodeBlocks(arena, comp, comp_len, &coded_len);
+      }
+      else {
+         coded = ArenaAlloc(arena, HUFFMAN_ENCODE_OUT_SIZE(comp_len));
+         coded_len = HuffmanEncode(comp, comp_len, coded);
+      }
+
+      if (coded_len > 0 && coded_len < comp_len - comp_len / BRUT_FILE_MIN_HUFFMAN_GAIN) {
+         comp = coded;
+         comp_len = coded_len;
+         chunk_flags |= BRUT_CHUNK_FLAG_HUFFMAN;
+      }
+   }
+
+   // payloads that don't shrink, or barely do when optimizing for
+   // speed, are stored as is so they're used directly from the bundle.
+   if ((chunk_flags & BRUT_CHUNK_FLAG_COMPRESSED) == BRUT_CHUNK_FLAG_COMPRESSED) {
+      int min_gain = speed ? src_len / BRUT_FILE_MIN_SPEED_GAIN : 0;
+      if (comp_len >= src_len - min_gain) {
+         comp = src;
+         comp_len = src_len;
+         chunk_flags = 0;
+      }
+   }
+
+   *out_len = comp_len;
+   *out_flags = chunk_flags;
+   return comp;
+}
+
+// compresses a module or solid block the smallest way the settings allow,
+// setting the chunk flags and the uncompressed size to put in the index.
+// the result is in the arena, or is the source itself.
+static const char*
+ShipPayload(Arena* arena, const char* src, int src_len, const char* dict, int dict_len, bool solid, bool speed, int threads, int* out_len, int* out_raw_len, unsigned char* out_flags)
+{
+   unsigned char chunk_flags = 0;
+   int comp_len = 0;
+   const char* comp = CompressPayload(arena, src, src_len, dict, dict_len, solid, speed, threads, &comp_len, &chunk_flags);
+
+   *out_raw_len = src_len;
+
+   // bytecode compresses better split into streams of similar data,
+   // modules in solid blocks are used in place so they're left as is.
+   // joining the streams takes another pass, so it's skipped when
+   // optimizing for speed.
+   int split_len = 0;
+   char* split_bc = solid || speed ? 0 : SplitBytecode(arena, src, src_len, &split_len);
+   if (split_bc) {
+      unsigned char split_flags = 0;
+      int split_comp_len = 0;
+      const char* split_comp = CompressPayload(arena, split_bc, split_len, dict, dict_len, solid, speed, threads, &split_comp_len, &split_flags);
+
+      if (split_comp_len < comp_len) {
+         comp = split_comp;
+         comp_len = split_comp_len;
+         chunk_flags = split_flags | BRUT_CHUNK_FLAG_BYTECODE;
+         *out_raw_len = split_len;
+      }
+   }
+
+   if (solid)
+      { chunk_flags |= BRUT_CHUNK_FLAG_BLOCK; }
+
+   *out_len = comp_len;
+   *out_flags = chunk_flags;
+   return comp;
+}
+
+// ship keeps what it compiles and compresses in BRUT_CACHE_DIR, so
+// modules that haven't changed since the last ship are only read back.
+// each file is named after the hash of everything its contents depend
+// on, so they're never stale. entries are touched when they're used and
+// removed once they haven't been for BRUT_CACHE_MAX_AGE seconds, so
+// ships with different settings don't evict each other (see PruneCache).
+// a cache file (little-endian) has the following structure:
+// key (unsigned 64-bit integer)
+// data size (unsigned 32-bit integer)
+// data
+#define BRUT_CACHE_HEADER_SIZE 12
+
+static char*
+ReadCacheEntry(unsigned long long key, int* out_len)
+{
+   char path[64];
+   snprintf(path, sizeof(path), BRUT_CACHE_DIR "/%016llx", key);
+
+   int len = 0;
+   char* data = ReadEntireFile(path, &len);
+   if (!data)
+      { return 0; }
+
+   // entries cut short or for another key are misses
+   unsigned long long data_key = 0;
+   if (len >= BRUT_CACHE_HEADER_SIZE)
+      { memcpy(&data_key, data, 8); }
+
+   if (len < BRUT_CACHE_HEADER_SIZE || data_key != key || ReadU32(&data[8]) != (unsigned int)(len - BRUT_CACHE_HEADER_SIZE)) {
+      free(data);
+      return 0;
+   }
+
+   TouchFile(path);
+
+   *out_len = len - BRUT_CACHE_HEADER_SIZE;
+   memmove(data, &data[BRUT_CACHE_HEADER_SIZE], *out_len);
+   return data;
+}
+
+// failing to write an entry only means the work is redone next time
+static void
+WriteCacheEntry(unsigned long long key, const char* data, int len)
+{
+   char path[64];
+   snprintf(path, sizeof(path), BRUT_CACHE_DIR "/%016llx", key);
+
+   dyn_array_t(char) entry = 0;
+   BufPushLen(&entry, (char *)&key, 8);
+   BufPushLen(&entry, (char *)&len, 4);
+   BufPushLen(&entry, data, len);
+
+   WriteEntireFile(path, entry, stbds_arrlen(entry));
+   stbds_arrfree(entry);
+}
+
+// entries that haven't been used in a while are removed, otherwise
+// every edit would leave another one behind.
+static void
+PruneCache(void)
+{
+   long long now = (long long)time(0);
+
+   dyn_array_t(char*) entries = 0;
+
+   #if PLATFORM_WINDOWS
+      ListDirectory(BRUT_CACHE_DIR "/*.*", &entries);
+   #else
+      ListDirectory(BRUT_CACHE_DIR, &entries);
+   #endif
+
+   for (int i = 0; i < stbds_arrlen(entries); i += 1) {
+      char* entry = entries[i];
+
+      // only files named like an entry are ours to remove
+      char* end = 0;
+      strtoull(entry, &end, 16);
+      if (strlen(entry) == 16 && *end == '\0') {
+         char path[64];
+         snprintf(path, sizeof(path), BRUT_CACHE_DIR "/%s", entry);
+
+         long long modified = 0;
+         if (GetModifiedTime(path, &modified) && now - modified > BRUT_CACHE_MAX_AGE)
+            { remove(path); }
+      }
+
+      free(entry);
+   }
+
+   stbds_arrfree(entries);
+}
+
+// the header of a dump holds the flags of the luajit build that made it,
+// like FR2 on GC64 builds, which neither the version nor the architecture
+// tell apart. it's hashed from an empty chunk, compiled once per worker.
+// returns 0 if the dump can't be read.
+static unsigned long long
+BytecodeTarget(ShipWorker* worker)
+{
+   if (worker->target != 0)
+      { return worker->target; }
+
+   int len = 0;
+   char* bc = SourceToBytecode(worker, "target", "", &len);
+   int header_len = bc ? DumpHeaderSize(bc, len) : 0;
+
+   if (header_len > 0)
+      { worker->target = HashBytes(HASH_SEED, bc, header_len); }
+
+   free(bc);
+   return worker->target;
+}
+
+// bytecode depends on the name and source of a module, and the version
+// and target of luajit that compiled it. returns 0 if the module can't
+// be compiled.
+static char*
+CompileSource(ShipWorker* worker, const char* name, bool cache, int* out_len)
+{
+   dyn_array_t(char) path = 0;
+   BufPush(&path, name);
+   BufPush(&path, ".lua");
+   stbds_arrput(path, '\0');
+
+   char* source = ReadEntireFile(path, 0);
+   if (!source) {
+      Log("unable to add '%s' to %s", path, BRUT_FILE);
+      stbds_arrfree(path);
+      return 0;
+   }
+
+   stbds_arrfree(path);
+
+   unsigned long long key = HashBytes(HASH_SEED, LUAJIT_VERSION, sizeof(LUAJIT_VERSION));
+   key = HashBytes(key, ARCH_NAME, sizeof(ARCH_NAME));
+   key = HashBytes(key, BRUT_FILE_CUSTOM_DATA, 8);
+   key = HashBytes(key, name, strlen(name) + 1);
+   key = HashBytes(key, source, strlen(source));
+
+   // without the build flags a cached dump could be for another build
+   unsigned long long target = cache ? BytecodeTarget(worker) : 0;
+   key = HashBytes(key, (char *)&target, 8);
+   cache = cache && target != 0;
+
+   int bc_len = 0;
+   char* bc = cache ? ReadCacheEntry(key, &bc_len) : 0;
+
+   if (!bc || bc_len == 0) {
+      free(bc);
+      bc = SourceToBytecode(worker, name, source, &bc_len);
+      if (bc && bc_len == 0) {
+         free(bc);
+         bc = 0;
+      }
+
+      if (bc && cache)
+         { WriteCacheEntry(key, bc, bc_len); }
+   }
+
+   free(source);
+
+   *out_len = bc_len;
+   return bc;
+}
+
+typedef struct {
+   char**                          names;
+   ShipWorker*                     workers;
+   bool                            cache;
+   dyn_array_t(int)                lengths;  // -1 if the module didn't compile
+   dyn_array_t(unsigned long long) hashes;   // of the bytecode
+   dyn_array_t(char*)              bytecode; // 0 if it's in the scratch file
+   dyn_array_t(unsigned int)       scratch_offs;
+   int                             kept_len;
+   OutputFile                      scratch;
+   const char*                     scratch_data; // mapped once it's written
+   int                             scratch_len;
+   Mutex                           lock;
+} CompileJob;
+
+// every module is compiled once, up front, to find its size and hash.
+// as much bytecode as the dictionary could sample is kept in memory,
+// the rest goes to a scratch file that's read back when its payload is
+// shipped, so memory stays bounded however large the project is.
+static void
+CompileModule(void* data, int i, int worker)
+{
+   CompileJob* job = data;
+   Log("processing '%s.lua'", job->names[i]);
+
+   int bc_len = 0;
+   char* bc = CompileSource(&job->workers[worker], job->names[i], job->cache, &bc_len);
+
+   job->lengths[i] = bc ? bc_len : -1;
+   job->hashes[i]  = bc ? HashBytes(HASH_SEED, bc, bc_len) : 0;
+
+   if (!bc)
+      { return; }
+
+   LockMutex(&job->lock);
+
+   if (job->kept_len + bc_len <= BRUT_FILE_DICT_SAMPLE_SIZE) {
+      job->bytecode[i] = bc;
+      job->kept_len += bc_len;
+      bc = 0;
+   }
+   else {
+      job->scratch_offs[i] = job->scratch.len;
+      WriteOutput(&job->scratch, bc, bc_len);
+   }
+
+   UnlockMutex(&job->lock);
+   free(bc);
+}
+
+// copies the bytecode of a module to out, which must hold all of it
+static void
+LoadBytecode(CompileJob* modules, int i, char* out)
+{
+   if (modules->bytecode[i])
+      { memcpy(out, modules->bytecode[i], modules->lengths[i]); }
+   else
+      { memcpy(out, &modules->scratch_data[modules->scratch_offs[i]], modules->lengths[i]); }
+}
+
+typedef struct {
+   CompileJob*                modules;
+   dyn_array_t(int)           block_first; // first module of each solid block
+   int                        first;       // payload of the first call
+   const char*                dict;
+   int                        dict_len;
+   unsigned long long         settings;
+   bool                       solid;
+   bool                       speed;
+   bool                       cache;
+   int                        threads;
+   ShipWorker*                workers;
+   dyn_array_t(char*)         payloads;
+   dyn_array_t(int)           lengths;
+   dyn_array_t(int)           raw_lengths; // what goes in the index
+   dyn_array_t(unsigned char) flags;
+} ShipJob;
+
+// compressed payloads depend on the bytecode they hold and the settings
+// of the bundle. they're keyed by the hash of each module's bytecode, so
+// cached ones never load it. the cached data is the flags, the size to
+// put in the index and the payload.
+static void
+ShipModule(void* data, int i, int worker)
+{
+   ShipJob* job = data;
+   CompileJob* modules = job->modules;
+   Arena* arena = &job->workers[worker].arena;
+
+   // each payload is either a solid block or a single module
+   int p = job->first + i;
+   int first = p;
+   int end = p + 1;
+
+   if (job->solid) {
+      first = job->block_first[p];
+      end = p + 1 < stbds_arrlen(job->block_first) ? job->block_first[p + 1] : stbds_arrlen(modules->lengths);
+   }
+
+   unsigned long long key = job->settings;
+   int src_len = 0;
+
+   for (int m = first; m < end; m += 1) {
+      key = HashBytes(key, (char *)&modules->hashes[m], 8);
+      src_len += modules->lengths[m];
+   }
+
+   unsigned char chunk_flags = 0;
+   int comp_len = 0;
+   char* comp = 0;
+
+   int cached_len = 0;
+   char* cached = job->cache ? ReadCacheEntry(key, &cached_len) : 0;
+   if (cached && cached_len >= 5) {
+      chunk_flags = cached[0];
+      job->raw_lengths[i] = ReadU32(&cached[1]);
+      comp_len = cached_len - 5;
+      comp = memmove(cached, &cached[5], comp_len);
+   }
+   else {
+      free(cached);
+
+      // only the payload that's kept leaves the arena
+      char* src = ArenaAlloc(arena, src_len);
+      int src_off = 0;
+
+      for (int m = first; m < end; m += 1) {
+         LoadBytecode(modules, m, &src[src_off]);
+         src_off += modules->lengths[m];
+      }
+
+      int raw_len = 0;
+      const char* shipped = ShipPayload(arena, src, src_len, job->dict, job->dict_len, job->solid, job->speed, job->threads, &comp_len, &raw_len, &chunk_flags);
+      job->raw_lengths[i] = raw_len;
+
+      if (job->cache) {
+         char* entry = ArenaAlloc(arena, 5 + comp_len);
+         entry[0] = chunk_flags;
+         memcpy(&entry[1], &raw_len, 4);
+         memcpy(&entry[5], shipped, comp_len);
+         WriteCacheEntry(key, entry, 5 + comp_len);
+      }
+
+      comp = CopyStringLen(shipped, comp_len);
+      ArenaReset(arena);
+   }
+
+   job->payloads[i] = comp;
+   job->lengths[i]  = comp_len;
+   job->flags[i]    = chunk_flags;
+}
+
+static int
+CompareNames(const void* a, const void* b)
+{ return strcmp(*(char* const*)a, *(char* const*)b); }
+
 static bool
-CreateBrutFile(const char* path)
+CreateBrutFile(const char* path, bool exe, bool solid, bool speed, bool cache)
 {
-   dyn_array_t(char*) files = 0;
    dyn_array_t(char*) names = 0;
 
-   // mark each .lua file for processing.
-   // the order of files does not matter.
+   // mark each .lua file for processing. they're sorted by name so
+   // the same modules always make the same bundle.
    dyn_array_t(char*) entries = 0;
 
    #if PLATFORM_WINDOWS
@@ -427,30 +1453,232 @@ CreateBrutFile(const char* path)
       ListDirectory(".", &entries);
    #endif
 
+   if (entries)
+      { qsort(entries, stbds_arrlen(entries), sizeof(char*), CompareNames); }
+
    for (int i = 0; i < stbds_arrlen(entries); i += 1) {
       char* entry = entries[i];
-      if (!EndsWith(entry, ".lua"))
-         { continue; }
+      if (EndsWith(entry, ".lua")) {
+         entry[strlen(entry) - 4] = '\0';
+         stbds_arrput(names, entry);
+      }
+      else
+         { free(entry); }
+   }
 
-      char* data = ReadEntireFile(entry);
-      if (!data) {
-         Log("unable add '%s' to %s", entry, BRUT_FILE);
-         return false;
+   stbds_arrfree(entries);
+
+   unsigned short total_names = stbds_arrlen(names);
+
+   if (cache && !MakeDirectory(BRUT_CACHE_DIR)) {
+      Log("unable to create %s, not caching", BRUT_CACHE_DIR);
+      cache = false;
+   }
+
+   // modules are compiled, and later compressed, on every core.
+   // each one has its own lua state so they don't share anything.
+   int threads = GetProcessorCount();
+
+   ShipWorker* workers = calloc(threads, sizeof(ShipWorker));
+
+   // everything from here on is freed at the end, whether or not the
+   // bundle could be shipped.
+   dyn_array_t(int)           block_first   = 0;
+   dyn_array_t(int)           block_lengths = 0;
+   dyn_array_t(int)           block_ids     = 0;
+   dyn_array_t(int)           block_offs    = 0;
+   dyn_array_t(unsigned int)  offsets       = 0;
+   dyn_array_t(int)           lengths       = 0;
+   dyn_array_t(int)           entry_lengths = 0;
+   dyn_array_t(unsigned char) flags         = 0;
+   dyn_array_t(char)          buffer        = 0;
+   dyn_array_t(char)          part_path     = 0;
+   dyn_array_t(char)          scratch_path  = 0;
+   char* dict = 0;
+   int dict_len = 0;
+   bool dict_used = false;
+   OutputFile out = {0};
+   bool ok = false;
+
+   CompileJob modules = { names, workers, cache, 0, 0, 0, 0, 0, {0}, 0, 0, MUTEX_INIT };
+   stbds_arrsetlen(modules.lengths, total_names);
+   stbds_arrsetlen(modules.hashes, total_names);
+   stbds_arrsetlen(modules.bytecode, total_names);
+   stbds_arrsetlen(modules.scratch_offs, total_names);
+
+   for (int i = 0; i < total_names; i += 1)
+      { modules.bytecode[i] = 0; }
+
+   // the scratch file sits next to the output, like the bundle while
+   // it's being written.
+   BufPush(&scratch_path, path);
+   BufPush(&scratch_path, ".bc.part");
+   stbds_arrput(scratch_path, '\0');
+
+   if (!OpenOutputFile(&modules.scratch, scratch_path)) {
+      Log("failed to create %s", scratch_path);
+      goto done;
+   }
+
+   ParallelFor(total_names, threads, CompileModule, &modules);
+
+   if (!CloseOutputFile(&modules.scratch)) {
+      Log("failed to write %s", scratch_path);
+      goto done;
+   }
+
+   if (modules.scratch.len > 0) {
+      modules.scratch_data = MapEntireFile(scratch_path, &modules.scratch_len);
+      if (!modules.scratch_data) {
+         Log("unable to read %s", scratch_path);
+         goto done;
       }
+   }
+
+   dyn_array_t(int) raw_lengths = modules.lengths;
 
-      char* name = CopyString(entry);
-      for (int i = strlen(name) - 1; i >= 0; i -= 1) {
-         if (name[i] == '.') {
-            name[i] = '\0';
-            break;
+   for (int i = 0; i < total_names; i += 1) {
+      if (raw_lengths[i] < 0)
+         { goto done; }
+   }
+
+   // in solid mode modules are joined into a few large blocks that are
+   // compressed as a whole, so matches can cross module boundaries and
+   // small modules still get compressed. each module then points into
+   // the decompressed data of its block. blocks are only put together
+   // when they're compressed.
+   if (solid) {
+      for (int i = 0; i < total_names; i += 1) {
+         int last = stbds_arrlen(block_lengths) - 1;
+         if (last < 0 || block_lengths[last] + raw_lengths[i] > BRUT_FILE_SOLID_BLOCK_SIZE) {
+            stbds_arrput(block_first, i);
+            stbds_arrput(block_lengths, 0);
+            last += 1;
          }
+
+         stbds_arrput(block_ids, last);
+         stbds_arrput(block_offs, block_lengths[last]);
+         block_lengths[last] += raw_lengths[i];
       }
 
-      stbds_arrput(files, data);
-      stbds_arrput(names, name);
+      if (stbds_arrlen(block_lengths) > BRUT_FILE_MAX_SOLID_BLOCKS) {
+         Log("too many solid blocks (%d)", (int)stbds_arrlen(block_lengths));
+         goto done;
+      }
    }
 
-   stbds_arrfree(entries);
+   // the payloads are every solid block, or every module
+   // when there aren't any.
+   int total_sources = solid ? stbds_arrlen(block_lengths) : total_names;
+
+   stbds_arrfree(block_lengths);
+
+   // the dictionary is trained on the chunks in the bundle, so the
+   // bytecode patterns they share are only stored once. solid blocks
+   // already share them.
+
+   if (!solid && total_names > 1) {
+      // it's trained on as many modules as fit in the sample size,
+      // so large projects don't have to load all of their bytecode.
+      dyn_array_t(int) sampled = 0;
+      int sample_size = 0;
+
+      for (int i = 0; i < total_names; i += 1) {
+         if (sample_size + raw_lengths[i] > BRUT_FILE_DICT_SAMPLE_SIZE)
+            { continue; }
+
+         stbds_arrput(sampled, i);
+         sample_size += raw_lengths[i];
+      }
+
+      // training only depends on the bytecode it's given, so it's
+      // cached by the hash of each sample. the same modules always
+      // train the same dictionary, with or without the cache.
+      unsigned long long key = HashBytes(HASH_SEED, "dictionary", sizeof("dictionary"));
+      int dict_size = BRUT_FILE_DICT_SIZE;
+      key = HashBytes(key, (char *)&dict_size, 4);
+
+      for (int i = 0; i < stbds_arrlen(sampled); i += 1) {
+         int m = sampled[i];
+         key = HashBytes(key, (char *)&modules.hashes[m], 8);
+         key = HashBytes(key, (char *)&raw_lengths[m], 4);
+      }
+
+      int cached_len = 0;
+      char* cached = cache ? ReadCacheEntry(key, &cached_len) : 0;
+
+      if (cached) {
+         dict_len = cached_len;
+         dict = dict_len > 0 ? CopyStringLen(cached, dict_len) : 0;
+         free(cached);
+      }
+      else {
+         dyn_array_t(char*) samples        = 0;
+         dyn_array_t(int)   sample_lengths = 0;
+
+         for (int i = 0; i < stbds_arrlen(sampled); i += 1) {
+            int m = sampled[i];
+            char* sample = malloc(raw_lengths[m]);
+            LoadBytecode(&modules, m, sample);
+
+            stbds_arrput(samples, sample);
+            stbds_arrput(sample_lengths, raw_lengths[m]);
+         }
+
+         dict = TrainDictionary(samples, sample_lengths, stbds_arrlen(samples), BRUT_FILE_DICT_SIZE, &dict_len);
+
+         for (int i = 0; i < stbds_arrlen(samples); i += 1)
+            { free(samples[i]); }
+
+         stbds_arrfree(samples);
+         stbds_arrfree(sample_lengths);
+
+         if (cache)
+            { WriteCacheEntry(key, dict ? dict : "", dict ? dict_len : 0); }
+      }
+
+      stbds_arrfree(sampled);
+   }
+
+   // the settings payloads depend on: the bundle version,
+   // how it's being shipped and the dictionary.
+   unsigned long long settings = HashBytes(HASH_SEED, "payload", sizeof("payload"));
+   unsigned char setting_bytes[4] = { BRUT_FILE_MAJOR, BRUT_FILE_MINOR, solid, speed };
+   settings = HashBytes(settings, (char *)setting_bytes, 4);
+   settings = HashBytes(settings, dict, dict ? dict_len : 0);
+
+   // the bundle is written as it's shipped, to a file next to the
+   // output that only replaces it once it's complete.
+   BufPush(&part_path, path);
+   BufPush(&part_path, ".part");
+   stbds_arrput(part_path, '\0');
+
+   if (!OpenOutputFile(&out, part_path)) {
+      Log("failed to create %s", path);
+      goto done;
+   }
+
+   // shipped executables are a copy of this runtime with the
+   // bundle appended, starting on a page boundary.
+   if (exe) {
+      char* exe_path = GetExePath();
+
+      int image_len = 0;
+      const char* image = exe_path ? MapEntireFile(exe_path, &image_len) : 0;
+      if (!image) {
+         Log("unable to read %s", exe_path ? exe_path : "brutus executable");
+         free(exe_path);
+         goto done;
+      }
+
+      WriteOutput(&out, image, image_len);
+      UnmapEntireFile(image, image_len);
+      free(exe_path);
+
+      PadOutput(&out, (out.len + BRUT_FILE_PAGE_SIZE - 1) / BRUT_FILE_PAGE_SIZE * BRUT_FILE_PAGE_SIZE);
+   }
+
+   unsigned int base = out.len;
 
    // a brut file (little-endian) starts with the following structure:
    // magic number (4-byte 'brut')
@@ -458,62 +1686,247 @@ CreateBrutFile(const char* path)
    // minor version (byte >= 0)
    // total entries (unsigned 16-bit integer)
    // app metadata (8-bytes)
-   dyn_array_t(char) buffer = 0;
-
    BufPush(&buffer, "brut");
    stbds_arrput(buffer, BRUT_FILE_MAJOR);
    stbds_arrput(buffer, BRUT_FILE_MINOR);
 
-   unsigned short total_names = stbds_arrlen(names);
-   BufPushLen(&buffer, (char *)&total_names, 2);
+   unsigned short total_entries = solid ? total_sources + total_names : total_names;
+   BufPushLen(&buffer, (char *)&total_entries, 2);
    BufPushLen(&buffer, BRUT_FILE_CUSTOM_DATA, 8);
 
-   // entries are placed sequentially and have the following structure:
-   // name (null-terminated string)
-   // compression marker (byte 0-1)
-   // payload size (unsigned 32-bit integer)
-   // payload (null-terminated string)
-   //    this will always be base64 encoded.
-   //    if the compression marker is 1, the
-   //    payload is lz4 compressed.
+   // followed by the chunk index:
+   // index entry size (unsigned 16-bit integer)
+   // reserved (2-bytes)
+   // dictionary offset (unsigned 32-bit integer)
+   // dictionary size (unsigned 32-bit integer)
+   // index entries, each with the following structure:
+   //    reserved (4-bytes, 0)
+   //    name offset (unsigned 32-bit integer)
+   //    name length (unsigned 16-bit integer)
+   //    flags (byte)
+   //    block (byte)
+   //    payload offset (unsigned 32-bit integer)
+   //    payload size (unsigned 32-bit integer)
+   //    uncompressed size (unsigned 32-bit integer)
+   //
+   // then every name (not null-terminated), every payload (raw bytes) and
+   // the dictionary. offsets are from the start of the bundle. if the
+   // compressed flag is set, the payload is fastlz compressed. if the
+   // dictionary flag is also set, it was compressed against the dictionary.
+   // if the split flag is set, the payload is a table of blocks that were
+   // compressed independently (see CompressBlocks). if the huffman flag is
+   // set, the compressed payload, or each of its blocks, is huffman coded
+   // (see huffman.c). if the bytecode flag is set, the uncompressed payload
+   // is bytecode split into separate streams (see bytecode.c).
+   //
+   // solid bundles start the index with their blocks, which have the block
+   // flag set and no name. modules with the solid flag set are stored in
+   // the given block, their payload offset and size are within its
+   // uncompressed data. blocks are never split, trading decoding a block
+   // on several threads for matches that reach across all of it.
+   //
+   // version 2.6 files had no split bytecode. version 2.5 files had no
+   // huffman coding. version 2.4 files had no split payloads. version 2.3
+   // files had no solid blocks. version 2.2 files had no dictionary.
+   // version 2.1 index entries had no uncompressed size. version 2.0 files
+   // had no index and placed each name length, name, flags, payload size
+   // and payload sequentially. version 1.1 files also used null-terminated
+   // names and base64 encoded payloads.
+   unsigned short entry_size = BRUT_FILE_INDEX_ENTRY_SIZE;
+   BufPushLen(&buffer, (char *)&entry_size, 2);
+   BufPushLen(&buffer, "\0\0", 2);
+
+   // the rest of the index is written once the payloads are
+   unsigned int index_off = stbds_arrlen(buffer);
+   unsigned int name_off = index_off + 8 + total_entries * BRUT_FILE_INDEX_ENTRY_SIZE;
+
+   WriteOutput(&out, buffer, stbds_arrlen(buffer));
+   PadOutput(&out, base + name_off);
+
+   unsigned int payload_off = name_off;
    for (int i = 0; i < total_names; i += 1) {
-      char* name = names[i];
-      Log("processing '%s.lua'", name);
+      WriteOutput(&out, names[i], strlen(names[i]));
+      payload_off += strlen(names[i]);
+   }
 
-      int bc_len = 0;
-      char* bc = SourceToBytecode(name, files[i], &bc_len);
-      if (!bc || bc_len == 0)
-         { return false; }
+   // payloads are compressed a few per thread at a time and written as
+   // soon as they're done, so only those are ever in memory. large
+   // payloads are also compressed on several threads, which only helps
+   // when there are fewer payloads than cores.
+   unsigned int dict_off = 0;
+   bool dict_placed = false;
+
+   int batch = threads * 4;
+   int block_threads = total_sources < threads ? threads : 1;
+
+   ShipJob job = { &modules, block_first, 0, dict, dict_len, settings, solid, speed, cache, block_threads, workers, 0, 0, 0, 0 };
+   stbds_arrsetlen(job.payloads, batch);
+   stbds_arrsetlen(job.lengths, batch);
+   stbds_arrsetlen(job.raw_lengths, batch);
+   stbds_arrsetlen(job.flags, batch);
+
+   for (int first = 0; first < total_sources && !out.failed; first += batch) {
+      int count = total_sources - first < batch ? total_sources - first : batch;
+      job.first = first;
+      ParallelFor(count, threads, ShipModule, &job);
+
+      // the payloads are placed so the runtime touches as few pages of
+      // the mapped bundle as possible: anything a page or larger starts
+      // on a page boundary, smaller payloads are packed but never
+      // straddle one.
+      for (int i = 0; i < count; i += 1) {
+         // the dictionary goes in the first gap this leaves that it
+         // fits in, it's only known to be used once every payload is
+         // compressed. the space would be padding otherwise.
+         unsigned int page_off = payload_off % BRUT_FILE_PAGE_SIZE;
+         if (!dict_placed && dict_len > 0 && page_off != 0 && page_off + job.lengths[i] > BRUT_FILE_PAGE_SIZE && page_off + dict_len <= BRUT_FILE_PAGE_SIZE) {
+            dict_off = PlacePayload(&payload_off, dict_len);
+            PadOutput(&out, base + dict_off);
+            WriteOutput(&out, dict, dict_len);
+            dict_placed = true;
+         }
+
+         unsigned int offset = PlacePayload(&payload_off, job.lengths[i]);
+         PadOutput(&out, base + offset);
+         WriteOutput(&out, job.payloads[i], job.lengths[i]);
 
-      bool did_comp = false;
-      int comp_len = 0;
-      char* comp = Compress(bc, bc_len, &comp_len, &did_comp);
+         stbds_arrput(offsets, offset);
+         stbds_arrput(lengths, job.lengths[i]);
+         stbds_arrput(entry_lengths, job.raw_lengths[i]);
+         stbds_arrput(flags, job.flags[i]);
 
-      int enc_len = 0;
-      char* enc = Encode(comp, comp_len, &enc_len);
+         if ((job.flags[i] & BRUT_CHUNK_FLAG_DICTIONARY) == BRUT_CHUNK_FLAG_DICTIONARY)
+            { dict_used = true; }
 
-      unsigned char flags = 0;
-      if (did_comp) flags |= BRUT_CHUNK_FLAG_COMPRESSED;
+         free(job.payloads[i]);
+      }
+   }
+
+   stbds_arrfree(job.payloads);
+   stbds_arrfree(job.lengths);
+   stbds_arrfree(job.raw_lengths);
+   stbds_arrfree(job.flags);
+
+   if (stbds_arrlen(offsets) != total_sources)
+      { goto done; }
+
+   // otherwise it comes last
+   if (!dict_used) {
+      dict_off = 0;
+      dict_len = 0;
+   }
+
+   if (dict_len > 0 && !dict_placed) {
+      dict_off = PlacePayload(&payload_off, dict_len);
+      PadOutput(&out, base + dict_off);
+      WriteOutput(&out, dict, dict_len);
+   }
+
+   BufClear(&buffer);
+   BufPushLen(&buffer, (char *)&dict_off, 4);
+   BufPushLen(&buffer, (char *)&dict_len, 4);
+
+   for (int i = 0; i < total_entries; i += 1) {
+      const char* name = "";
+      unsigned char entry_flags = BRUT_CHUNK_FLAG_SOLID;
+      unsigned char block = 0;
+      unsigned int offset = 0;
+      unsigned int length = 0;
+      unsigned int raw_length = 0;
+
+      if (i < total_sources) {
+         if (!solid)
+            { name = names[i]; }
+
+         entry_flags = flags[i];
+         offset = offsets[i];
+         length = lengths[i];
+         raw_length = entry_lengths[i];
+      }
+      else {
+         int m = i - total_sources;
+         name = names[m];
+         block = block_ids[m];
+         offset = block_offs[m];
+         length = raw_lengths[m];
+         raw_length = raw_lengths[m];
+      }
+
+      unsigned short name_len = strlen(name);
+      unsigned int reserved = 0;
+
+      BufPushLen(&buffer, (char *)&reserved, 4);
+      BufPushLen(&buffer, (char *)&name_off, 4);
+      BufPushLen(&buffer, (char *)&name_len, 2);
+      BufPushLen(&buffer, (char *)&entry_flags, 1);
+      BufPushLen(&buffer, (char *)&block, 1);
+      BufPushLen(&buffer, (char *)&offset, 4);
+      BufPushLen(&buffer, (char *)&length, 4);
+      BufPushLen(&buffer, (char *)&raw_length, 4);
+
+      name_off += name_len;
+   }
 
-      BufPush(&buffer, name);
-      BufPushLen(&buffer, "\0", 1);
-      BufPushLen(&buffer, (char *)&flags, 1);
-      BufPushLen(&buffer, (char *)&enc_len, 4);
-      BufPushLen(&buffer, enc, enc_len);
+   PatchOutput(&out, base + index_off, buffer, stbds_arrlen(buffer));
 
-      free(comp);
-      free(enc);
+   if (exe) {
+      unsigned int bundle_len = out.len - base;
+      WriteOutput(&out, (char *)&base, 4);
+      WriteOutput(&out, (char *)&bundle_len, 4);
+      WriteOutput(&out, BRUT_EXE_MAGIC, 8);
    }
 
-   stbds_arrfree(files);
+   ok = CloseOutputFile(&out) && RenameFile(part_path, path);
+   if (!ok)
+      { Log("failed to create %s", path); }
+
+done:
+   if (!ok && part_path) {
+      CloseOutputFile(&out);
+      remove(part_path);
+   }
+
+   if (ok && cache)
+      { PruneCache(); }
+
+   if (modules.scratch_data)
+      { UnmapEntireFile(modules.scratch_data, modules.scratch_len); }
+
+   if (scratch_path) {
+      CloseOutputFile(&modules.scratch);
+      remove(scratch_path);
+   }
+
+   FreeShipWorkers(workers, threads);
+
+   for (int i = 0; i < total_names; i += 1) {
+      free(names[i]);
+      free(modules.bytecode[i]);
+   }
+
+   free(dict);
+
+   stbds_arrfree(modules.lengths);
+   stbds_arrfree(modules.hashes);
+   stbds_arrfree(modules.bytecode);
+   stbds_arrfree(modules.scratch_offs);
+   stbds_arrfree(block_first);
+   stbds_arrfree(block_lengths);
+   stbds_arrfree(block_ids);
+   stbds_arrfree(block_offs);
+   stbds_arrfree(offsets);
+   stbds_arrfree(lengths);
+   stbds_arrfree(entry_lengths);
+   stbds_arrfree(flags);
+   stbds_arrfree(buffer);
+   stbds_arrfree(part_path);
+   stbds_arrfree(scratch_path);
    stbds_arrfree(names);
 
-   if (!WriteEntireFile(path, buffer, stbds_arrlen(buffer))) {
-      stbds_arrfree(buffer);
-      Log("failed to create %s", BRUT_FILE);
+   if (ok && exe && !MakeExecutable(path)) {
+      Log("unable to mark %s as executable", path);
       return false;
    }
 
-   stbds_arrfree(buffer);
-   return true;
+   return ok;
 }
@@ -130,7 +130,11 @@ base64_decode(const char *in, unsigned int inlen, unsigned char *out)
       return 0;
    }
 
-   for (i = j = 0; i < inlen; i++) {
+   /* whole blocks are decoded by a vector kernel when there is one */
+   i = Base64DecodeBlocks(in, inlen, out);
+   j = i / 4 * 3;
+
+   for (; i < inlen; i++) {
       if (in[i] == BASE64_PAD) {
          break;
       }
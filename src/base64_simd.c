@@ -0,0 +1,255 @@
+// Copyright (c) 2024 Judah Caruso
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// vectorized base64 decoding. each kernel decodes whole blocks of text and
+// stops at the first block with padding or an invalid character, leaving
+// the rest to the scalar decoder. characters are mapped to their values
+// by range:
+// 'A'..'Z' -> 0..25  (c - 65)
+// 'a'..'z' -> 26..51 (c - 71)
+// '0'..'9' -> 52..61 (c + 4)
+// '+'      -> 62     (c + 19)
+// '/'      -> 63     (c + 16)
+
+enum {
+   BASE64_KERNEL_SCALAR,
+   BASE64_KERNEL_SSSE3,
+   BASE64_KERNEL_AVX2,
+   BASE64_KERNEL_NEON,
+};
+
+// picked once at startup by InitBase64Kernel
+static int BASE64_KERNEL = BASE64_KERNEL_SCALAR;
+
+#if defined(__x86_64__) || defined(_M_X64)
+   #define BASE64_X86 1
+
+   #if defined(_MSC_VER)
+      #include <intrin.h>
+      #define BASE64_TARGET(t)
+   #else
+      #include <immintrin.h>
+      #define BASE64_TARGET(t) __attribute__((target(t)))
+   #endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+   #define BASE64_NEON 1
+   #include <arm_neon.h>
+#endif
+
+#if BASE64_X86
+
+static void
+Base64Store12(unsigned char* out, __m128i bytes)
+{
+   _mm_storel_epi64((__m128i*)out, bytes);
+
+   int tail = _mm_cvtsi128_si32(_mm_srli_si128(bytes, 8));
+   memcpy(&out[8], &tail, 4);
+}
+
+BASE64_TARGET("ssse3") static unsigned int
+Base64DecodeSsse3(const char* in, unsigned int len, unsigned char* out)
+{
+   unsigned int i = 0;
+   for (; i + 16 <= len; i += 16) {
+      __m128i c = _mm_loadu_si128((const __m128i*)&in[i]);
+
+      // bytes past 127 compare as negative, so they're in no range
+      __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8('Z' + 1)));
+      __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8('z' + 1)));
+      __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+      __m128i plus  = _mm_cmpeq_epi8(c, _mm_set1_epi8('+'));
+      __m128i slash = _mm_cmpeq_epi8(c, _mm_set1_epi8('/'));
+
+      __m128i valid = _mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(_mm_or_si128(digit, plus), slash));
+      if (_mm_movemask_epi8(valid) != 0xffff)
+         { break; }
+
+      __m128i shift = _mm_or_si128(
+         _mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-65)), _mm_and_si128(lower, _mm_set1_epi8(-71))),
+         _mm_or_si128(_mm_or_si128(_mm_and_si128(digit, _mm_set1_epi8(4)), _mm_and_si128(plus, _mm_set1_epi8(19))),
+                      _mm_and_si128(slash, _mm_set1_epi8(16))));
+
+      __m128i values = _mm_add_epi8(c, shift);
+
+      // join the four 6-bit values of each 32-bit lane into 24 bits,
+      // then gather the three bytes of every lane in order.
+      __m128i pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+      __m128i quads = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+      __m128i bytes = _mm_shuffle_epi8(quads, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+
+      Base64Store12(&out[i / 4 * 3], bytes);
+   }
+
+   return i;
+}
+
+BASE64_TARGET("avx2") static unsigned int
+Base64DecodeAvx2(const char* in, unsigned int len, unsigned char* out)
+{
+   unsigned int i = 0;
+   for (; i + 32 <= len; i += 32) {
+      __m256i c = _mm256_loadu_si256((const __m256i*)&in[i]);
+
+      __m256i upper = _mm256_andnot_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('Z')), _mm256_cmpgt_epi8(c, _mm256_set1_epi8('A' - 1)));
+      __m256i lower = _mm256_andnot_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('z')), _mm256_cmpgt_epi8(c, _mm256_set1_epi8('a' - 1)));
+      __m256i digit = _mm256_andnot_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('9')), _mm256_cmpgt_epi8(c, _mm256_set1_epi8('0' - 1)));
+      __m256i plus  = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('+'));
+      __m256i slash = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('/'));
+
+      __m256i valid = _mm256_or_si256(_mm256_or_si256(upper, lower), _mm256_or_si256(_mm256_or_si256(digit, plus), slash));
+      if (_mm256_movemask_epi8(valid) != -1)
+         { break; }
+
+      __m256i shift = _mm256_or_si256(
+         _mm256_or_si256(_mm256_and_si256(upper, _mm256_set1_epi8(-65)), _mm256_and_si256(lower, _mm256_set1_epi8(-71))),
+         _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(digit, _mm256_set1_epi8(4)), _mm256_and_si256(plus, _mm256_set1_epi8(19))),
+                         _mm256_and_si256(slash, _mm256_set1_epi8(16))));
+
+      __m256i values = _mm256_add_epi8(c, shift);
+
+      // same as the ssse3 kernel, the shuffle works within each 128-bit half
+      __m256i pairs = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+      __m256i quads = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+      __m256i bytes = _mm256_shuffle_epi8(quads, _mm256_setr_epi8(
+         2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+         2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+
+      Base64Store12(&out[i / 4 * 3], _mm256_castsi256_si128(bytes));
+      Base64Store12(&out[i / 4 * 3 + 12], _mm256_extracti128_si256(bytes, 1));
+   }
+
+   return i;
+}
+
+static int
+Base64DetectKernel(void)
+{
+#if defined(_MSC_VER)
+   int info[4];
+   __cpuid(info, 0);
+   if (info[0] < 7)
+      { return BASE64_KERNEL_SCALAR; }
+
+   __cpuid(info, 1);
+   bool ssse3   = (info[2] & (1 << 9)) != 0;
+   bool osxsave = (info[2] & (1 << 27)) != 0;
+   bool avx     = (info[2] & (1 << 28)) != 0;
+
+   __cpuidex(info, 7, 0);
+   bool avx2 = (info[1] & (1 << 5)) != 0;
+
+   // the os also has to save the upper halves of the avx registers
+   if (avx2 && avx && osxsave && (_xgetbv(0) & 6) == 6)
+      { return BASE64_KERNEL_AVX2; }
+
+   return ssse3 ? BASE64_KERNEL_SSSE3 : BASE64_KERNEL_SCALAR;
+#else
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx2"))
+      { return BASE64_KERNEL_AVX2; }
+
+   return __builtin_cpu_supports("ssse3") ? BASE64_KERNEL_SSSE3 : BASE64_KERNEL_SCALAR;
+#endif
+}
+
+#elif BASE64_NEON
+
+static uint8x16_t
+Base64ValuesNeon(uint8x16_t c, uint8x16_t* invalid)
+{
+   uint8x16_t upper = vandq_u8(vcgeq_u8(c, vdupq_n_u8('A')), vcleq_u8(c, vdupq_n_u8('Z')));
+   uint8x16_t lower = vandq_u8(vcgeq_u8(c, vdupq_n_u8('a')), vcleq_u8(c, vdupq_n_u8('z')));
+   uint8x16_t digit = vandq_u8(vcgeq_u8(c, vdupq_n_u8('0')), vcleq_u8(c, vdupq_n_u8('9')));
+   uint8x16_t plus  = vceqq_u8(c, vdupq_n_u8('+'));
+   uint8x16_t slash = vceqq_u8(c, vdupq_n_u8('/'));
+
+   uint8x16_t valid = vorrq_u8(vorrq_u8(upper, lower), vorrq_u8(vorrq_u8(digit, plus), slash));
+   *invalid = vorrq_u8(*invalid, vmvnq_u8(valid));
+
+   uint8x16_t shift = vorrq_u8(
+      vorrq_u8(vandq_u8(upper, vdupq_n_u8((unsigned char)-65)), vandq_u8(lower, vdupq_n_u8((unsigned char)-71))),
+      vorrq_u8(vorrq_u8(vandq_u8(digit, vdupq_n_u8(4)), vandq_u8(plus, vdupq_n_u8(19))),
+               vandq_u8(slash, vdupq_n_u8(16))));
+
+   return vaddq_u8(c, shift);
+}
+
+static unsigned int
+Base64DecodeNeon(const char* in, unsigned int len, unsigned char* out)
+{
+   unsigned int i = 0;
+   for (; i + 64 <= len; i += 64) {
+      // split the text into the first, second, third and fourth
+      // character of every quad.
+      uint8x16x4_t c = vld4q_u8((const uint8_t*)&in[i]);
+
+      uint8x16_t invalid = vdupq_n_u8(0);
+      uint8x16_t a = Base64ValuesNeon(c.val[0], &invalid);
+      uint8x16_t b = Base64ValuesNeon(c.val[1], &invalid);
+      uint8x16_t d = Base64ValuesNeon(c.val[2], &invalid);
+      uint8x16_t e = Base64ValuesNeon(c.val[3], &invalid);
+
+      if (vmaxvq_u8(invalid) != 0)
+         { break; }
+
+      uint8x16x3_t bytes;
+      bytes.val[0] = vorrq_u8(vshlq_n_u8(a, 2), vshrq_n_u8(b, 4));
+      bytes.val[1] = vorrq_u8(vshlq_n_u8(b, 4), vshrq_n_u8(d, 2));
+      bytes.val[2] = vorrq_u8(vshlq_n_u8(d, 6), e);
+      vst3q_u8(&out[i / 4 * 3], bytes);
+   }
+
+   return i;
+}
+
+#endif
+
+// must be called before any threads are started
+static void
+InitBase64Kernel(void)
+{
+#if BASE64_X86
+   BASE64_KERNEL = Base64DetectKernel();
+#elif BASE64_NEON
+   BASE64_KERNEL = BASE64_KERNEL_NEON;
+#endif
+}
+
+// decodes as many whole blocks of base64 text as the best available kernel
+// can, returns the number of characters decoded (always a multiple of 4).
+static unsigned int
+Base64DecodeBlocks(const char* in, unsigned int len, unsigned char* out)
+{
+   unsigned int done = 0;
+
+#if BASE64_X86
+   if (BASE64_KERNEL == BASE64_KERNEL_AVX2)
+      { done = Base64DecodeAvx2(in, len, out); }
+
+   if (BASE64_KERNEL >= BASE64_KERNEL_SSSE3)
+      { done += Base64DecodeSsse3(&in[done], len - done, &out[done / 4 * 3]); }
+#elif BASE64_NEON
+   if (BASE64_KERNEL == BASE64_KERNEL_NEON)
+      { done = Base64DecodeNeon(in, len, out); }
+#endif
+
+   return done;
+}
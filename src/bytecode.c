@@ -0,0 +1,353 @@
+// Copyright (c) 2024 Judah Caruso
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// luajit bytecode dumps interleave prototype headers, fixed-width
+// instructions, constants and debug info, which compress better when
+// each kind is stored together. split bytecode (little-endian) has the
+// following structure:
+// size of each stream (5 unsigned 32-bit integers)
+// headers (dump header, then each prototype's size and header)
+// opcodes (first byte of each instruction)
+// operands (last three bytes of each instruction)
+// constants (upvalues and constants of each prototype)
+// debug info (of each prototype)
+
+#define BYTECODE_STREAMS 5
+#define BYTECODE_HEADER_SIZE (BYTECODE_STREAMS * 4)
+
+enum {
+   BYTECODE_HEADERS,
+   BYTECODE_OPCODES,
+   BYTECODE_OPERANDS,
+   BYTECODE_CONSTANTS,
+   BYTECODE_DEBUG,
+};
+
+// luajit dump flags
+#define BYTECODE_FLAG_BE    0x01
+#define BYTECODE_FLAG_STRIP 0x02
+
+typedef struct {
+   const unsigned char* ptr;
+   const unsigned char* end;
+} BytecodeReader;
+
+static bool
+ReadUleb128(BytecodeReader* r, unsigned int* out)
+{
+   unsigned int value = 0;
+   for (int shift = 0; shift < 35; shift += 7) {
+      if (r->ptr >= r->end)
+         { return false; }
+
+      unsigned char b = *r->ptr++;
+      value |= (unsigned int)(b & 0x7f) << shift;
+      if ((b & 0x80) == 0) {
+         *out = value;
+         return true;
+      }
+   }
+
+   return false;
+}
+
+// the parts of a prototype header needed to find the rest of it
+typedef struct {
+   unsigned int sizebc;
+   unsigned int sizedbg;
+} BytecodeProto;
+
+static bool
+ReadProtoHeader(BytecodeReader* r, bool strip, BytecodeProto* proto)
+{
+   // flags, numparams, framesize, sizeuv
+   if (r->end - r->ptr < 4)
+      { return false; }
+
+   r->ptr += 4;
+
+   unsigned int sizekgc = 0, sizekn = 0;
+   if (!ReadUleb128(r, &sizekgc) || !ReadUleb128(r, &sizekn) || !ReadUleb128(r, &proto->sizebc))
+      { return false; }
+
+   proto->sizedbg = 0;
+   if (!strip) {
+      if (!ReadUleb128(r, &proto->sizedbg))
+         { return false; }
+
+      // firstline, numline
+      unsigned int line = 0;
+      if (proto->sizedbg > 0 && (!ReadUleb128(r, &line) || !ReadUleb128(r, &line)))
+         { return false; }
+   }
+
+   return true;
+}
+
+// returns false if the dump isn't one this transform understands
+static bool
+ReadDumpHeader(BytecodeReader* r, bool* out_strip)
+{
+   if (r->end - r->ptr < 4 || memcmp(r->ptr, "\x1bLJ", 3) != 0)
+      { return false; }
+
+   r->ptr += 4;
+
+   unsigned int flags = 0;
+   if (!ReadUleb128(r, &flags) || (flags & BYTECODE_FLAG_BE))
+      { return false; }
+
+   *out_strip = (flags & BYTECODE_FLAG_STRIP) != 0;
+   if (!*out_strip) {
+      unsigned int name_len = 0;
+      if (!ReadUleb128(r, &name_len) || name_len > (unsigned int)(r->end - r->ptr))
+         { return false; }
+
+      r->ptr += name_len;
+   }
+
+   return true;
+}
+
+// the size of the magic, version and flags that start a dump, which
+// depend on how luajit was built. returns 0 if it isn't a dump.
+static int
+DumpHeaderSize(const char* dump, int len)
+{
+   BytecodeReader r = { (const unsigned char*)dump, (const unsigned char*)dump + len };
+   if (len < 4 || memcmp(dump, "\x1bLJ", 3) != 0)
+      { return 0; }
+
+   r.ptr += 4;
+
+   unsigned int flags = 0;
+   if (!ReadUleb128(&r, &flags))
+      { return 0; }
+
+   return (int)(r.ptr - (const unsigned char*)dump);
+}
+
+// the dump is walked twice, once to size each stream
+// and again to copy them into place.
+typedef struct {
+   char*        out;                   // 0 while sizing
+   unsigned int pos[BYTECODE_STREAMS];
+} SplitStreams;
+
+static void
+PushBytes(SplitStreams* s, int stream, const unsigned char* start, const unsigned char* end)
+{
+   if (s->out)
+      { memcpy(&s->out[s->pos[stream]], start, end - start); }
+
+   s->pos[stream] += end - start;
+}
+
+static bool
+WalkBytecode(const char* in, int len, SplitStreams* streams)
+{
+   BytecodeReader r = { (const unsigned char*)in, (const unsigned char*)in + len };
+
+   bool strip = false;
+   if (!ReadDumpHeader(&r, &strip))
+      { return false; }
+
+   PushBytes(streams, BYTECODE_HEADERS, (const unsigned char*)in, r.ptr);
+
+   while (true) {
+      const unsigned char* start = r.ptr;
+
+      unsigned int proto_len = 0;
+      if (!ReadUleb128(&r, &proto_len) || proto_len > (unsigned int)(r.end - r.ptr))
+         { return false; }
+
+      PushBytes(streams, BYTECODE_HEADERS, start, r.ptr);
+
+      // dumps end with a zero-sized prototype
+      if (proto_len == 0)
+         { break; }
+
+      BytecodeReader proto_r = { r.ptr, r.ptr + proto_len };
+      r.ptr += proto_len;
+
+      BytecodeProto proto;
+      if (!ReadProtoHeader(&proto_r, strip, &proto))
+         { return false; }
+
+      PushBytes(streams, BYTECODE_HEADERS, r.ptr - proto_len, proto_r.ptr);
+
+      unsigned int left = proto_r.end - proto_r.ptr;
+      if (proto.sizebc > left / 4 || proto.sizedbg > left - proto.sizebc * 4)
+         { return false; }
+
+      for (unsigned int i = 0; i < proto.sizebc; i += 1) {
+         PushBytes(streams, BYTECODE_OPCODES, proto_r.ptr, proto_r.ptr + 1);
+         PushBytes(streams, BYTECODE_OPERANDS, proto_r.ptr + 1, proto_r.ptr + 4);
+         proto_r.ptr += 4;
+      }
+
+      // everything up to the debug info is upvalues and constants
+      const unsigned char* debug = proto_r.end - proto.sizedbg;
+      PushBytes(streams, BYTECODE_CONSTANTS, proto_r.ptr, debug);
+      PushBytes(streams, BYTECODE_DEBUG, debug, proto_r.end);
+   }
+
+   // anything after the dump can't be split
+   return r.ptr == r.end;
+}
+
+// splits a bytecode dump into separate streams, returns 0 if it can't
+static char*
+SplitBytecode(Arena* arena, const char* in, int len, int* out_len)
+{
+   SplitStreams streams = {0};
+   if (!WalkBytecode(in, len, &streams))
+      { return 0; }
+
+   int total = BYTECODE_HEADER_SIZE;
+   for (int i = 0; i < BYTECODE_STREAMS; i += 1)
+      { total += streams.pos[i]; }
+
+   char* out = ArenaAlloc(arena, total);
+   unsigned int off = BYTECODE_HEADER_SIZE;
+
+   for (int i = 0; i < BYTECODE_STREAMS; i += 1) {
+      unsigned int stream_len = streams.pos[i];
+      memcpy(&out[i * 4], &stream_len, 4);
+
+      streams.pos[i] = off;
+      off += stream_len;
+   }
+
+   streams.out = out;
+   WalkBytecode(in, len, &streams);
+
+   *out_len = total;
+   return out;
+}
+
+// copies len bytes from a stream to op
+static bool
+TakeBytes(BytecodeReader* stream, char** op, unsigned int len)
+{
+   if (len > (unsigned int)(stream->end - stream->ptr))
+      { return false; }
+
+   memcpy(*op, stream->ptr, len);
+   stream->ptr += len;
+   *op += len;
+   return true;
+}
+
+// rebuilds a bytecode dump from the output of SplitBytecode, returns 0 if
+// the streams don't describe one. they're only rearranged, so the dump is
+// exactly as large as all of them together.
+static char*
+JoinBytecode(const char* in, int len, int* out_len)
+{
+   if (len < BYTECODE_HEADER_SIZE)
+      { return 0; }
+
+   BytecodeReader streams[BYTECODE_STREAMS];
+
+   unsigned int off = BYTECODE_HEADER_SIZE;
+   for (int i = 0; i < BYTECODE_STREAMS; i += 1) {
+      unsigned int stream_len = ReadU32(&in[i * 4]);
+      if (stream_len > len - off)
+         { return 0; }
+
+      streams[i].ptr = (const unsigned char*)&in[off];
+      streams[i].end = streams[i].ptr + stream_len;
+      off += stream_len;
+   }
+
+   int total = off - BYTECODE_HEADER_SIZE;
+   char* out = malloc(total > 0 ? total : 1);
+   char* op = out;
+
+   BytecodeReader* headers  = &streams[BYTECODE_HEADERS];
+   BytecodeReader* opcodes  = &streams[BYTECODE_OPCODES];
+   BytecodeReader* operands = &streams[BYTECODE_OPERANDS];
+
+   // bytes read from the header stream are copied as they are, nothing
+   // can be written past the end since it all comes from the streams.
+   const unsigned char* start = headers->ptr;
+   bool strip = false;
+   bool ok = ReadDumpHeader(headers, &strip);
+   bool done = false;
+
+   if (ok) {
+      memcpy(op, start, headers->ptr - start);
+      op += headers->ptr - start;
+   }
+
+   while (ok && !done) {
+      start = headers->ptr;
+
+      unsigned int proto_len = 0;
+      if (!ReadUleb128(headers, &proto_len))
+         { break; }
+
+      // dumps end with a zero-sized prototype
+      const unsigned char* proto_start = headers->ptr;
+      BytecodeProto proto = {0};
+      if (proto_len == 0)
+         { done = true; }
+      else if (!ReadProtoHeader(headers, strip, &proto))
+         { break; }
+
+      unsigned int header_len = headers->ptr - proto_start;
+      if (header_len > proto_len && !done)
+         { break; }
+
+      unsigned int left = done ? 0 : proto_len - header_len;
+      if (proto.sizebc > left / 4 || proto.sizedbg > left - proto.sizebc * 4 ||
+          proto.sizebc > (unsigned int)(opcodes->end - opcodes->ptr) ||
+          proto.sizebc > (unsigned int)(operands->end - operands->ptr) / 3)
+         { break; }
+
+      memcpy(op, start, headers->ptr - start);
+      op += headers->ptr - start;
+
+      for (unsigned int i = 0; i < proto.sizebc; i += 1) {
+         op[0] = opcodes->ptr[0];
+         memcpy(&op[1], operands->ptr, 3);
+         opcodes->ptr  += 1;
+         operands->ptr += 3;
+         op += 4;
+      }
+
+      left -= proto.sizebc * 4;
+      ok = TakeBytes(&streams[BYTECODE_CONSTANTS], &op, left - proto.sizedbg) &&
+           TakeBytes(&streams[BYTECODE_DEBUG], &op, proto.sizedbg);
+   }
+
+   // every stream has to be used up exactly
+   for (int i = 0; i < BYTECODE_STREAMS && ok; i += 1)
+      { ok = streams[i].ptr == streams[i].end; }
+
+   if (!ok || !done) {
+      free(out);
+      return 0;
+   }
+
+   *out_len = op - out;
+   return out;
+}
@@ -22,6 +22,7 @@
 */
 
 #include <stdint.h>
+#include <stdlib.h>
 
 #if defined(__GNUC__)
   #pragma GCC diagnostic push
@@ -352,11 +353,16 @@ static uint8_t* flz2_match(uint32_t len, uint32_t distance, uint8_t* op) {
   return op;
 }
 
-static int fastlz2_compress(const void* input, int length, void* output) {
+/*
+ * Compresses the length bytes that follow the first prefix bytes of input.
+ * Matches may reach back into the prefix, which lets a shared dictionary
+ * prime the compressor. With no prefix this is plain fastlz2_compress.
+ */
+static int fastlz2_compress_prefix(const void* input, int prefix, int length, void* output) {
   const uint8_t* ip = (const uint8_t*)input;
   const uint8_t* ip_start = ip;
-  const uint8_t* ip_bound = ip + length - 4; /* because readU32 */
-  const uint8_t* ip_limit = ip + length - 12 - 1;
+  const uint8_t* ip_bound = ip + prefix + length - 4; /* because readU32 */
+  const uint8_t* ip_limit = ip + prefix + length - 12 - 1;
   uint8_t* op = (uint8_t*)output;
 
   uint32_t htab[HASH_SIZE];
@@ -365,6 +371,13 @@ static int fastlz2_compress(const void* input, int length, void* output) {
   /* initializes hash table */
   for (hash = 0; hash < HASH_SIZE; ++hash) htab[hash] = 0;
 
+  /* primes the hash table with the prefix */
+  for (ip = ip_start; ip + 3 < ip_start + prefix; ++ip) {
+    seq = flz_readu32(ip) & 0xffffff;
+    htab[flz_hash(seq)] = ip - ip_start;
+  }
+  ip = ip_start + prefix;
+
   /* we start with literal copy */
   const uint8_t* anchor = ip;
   ip += 2;
@@ -417,7 +430,7 @@ static int fastlz2_compress(const void* input, int length, void* output) {
     anchor = ip;
   }
 
-  uint32_t copy = (uint8_t*)input + length - anchor;
+  uint32_t copy = (uint8_t*)input + prefix + length - anchor;
   op = flz_literals(copy, anchor, op);
 
   /* marker for fastlz2 */
@@ -426,7 +439,188 @@ static int fastlz2_compress(const void* input, int length, void* output) {
   return op - (uint8_t*)output;
 }
 
-static int fastlz2_decompress(const void* input, int length, void* output, int maxout) {
+static int fastlz2_compress(const void* input, int length, void* output) {
+  return fastlz2_compress_prefix(input, 0, length, output);
+}
+
+#define CHAIN_HASH_LOG 16
+#define CHAIN_HASH_SIZE (1 << CHAIN_HASH_LOG)
+#define MAX_CHAIN 512
+
+static uint32_t flz_chain_hash(uint32_t v) {
+  uint32_t h = ((v & 0xffffff) * 2654435769LL) >> (32 - CHAIN_HASH_LOG);
+  return h & (CHAIN_HASH_SIZE - 1);
+}
+
+/* bytes a match takes in a fastlz2 stream */
+static int32_t flz2_match_cost(uint32_t len, uint32_t distance) {
+  int32_t cost = distance <= MAX_L2_DISTANCE ? 2 : 4;
+  if (len >= 7 + 2) cost += 1 + (len - 7 - 2) / 255;
+  return cost;
+}
+
+typedef struct {
+  const uint8_t* start;
+  const uint8_t* end;
+  int32_t* head;
+  int32_t* prev;
+  uint32_t inserted;
+} flz_chain;
+
+static void flz_chain_update(flz_chain* chain, const uint8_t* ip) {
+  while (chain->start + chain->inserted < ip) {
+    uint32_t pos = chain->inserted++;
+    if (chain->start + pos + 4 > chain->end) continue;
+    uint32_t hash = flz_chain_hash(flz_readu32(chain->start + pos));
+    chain->prev[pos] = chain->head[hash];
+    chain->head[hash] = pos;
+  }
+}
+
+/* finds the match at ip that saves the most bytes, returns the bytes saved */
+static int32_t flz_chain_find(flz_chain* chain, const uint8_t* ip, uint32_t* out_len, uint32_t* out_distance) {
+  uint32_t seq = flz_readu32(ip) & 0xffffff;
+  int32_t pos = chain->head[flz_chain_hash(seq)];
+  int32_t best = 0;
+
+  for (int depth = 0; pos >= 0 && depth < MAX_CHAIN; ++depth, pos = chain->prev[pos]) {
+    const uint8_t* ref = chain->start + pos;
+    uint32_t distance = ip - ref;
+    if (distance >= MAX_FARDISTANCE) break;
+    if ((flz_readu32(ref) & 0xffffff) != seq) continue;
+
+    /* like fastlz2_compress, always end the stream with literals */
+    uint32_t len = 3;
+    while (ip + len < chain->end - 4 && ref[len] == ip[len]) ++len;
+
+    /* far, needs at least 5-byte match */
+    if (distance > MAX_L2_DISTANCE && len < 5) continue;
+
+    int32_t saved = (int32_t)len - flz2_match_cost(len, distance);
+    if (saved > best) {
+      best = saved;
+      *out_len = len;
+      *out_distance = distance;
+    }
+  }
+
+  return best;
+}
+
+/*
+ * Slow, high-ratio variant of fastlz2_compress_prefix. Every earlier
+ * position with the same hash is considered through hash chains and each
+ * match is only taken if the next position doesn't have a better one.
+ * The output is a regular fastlz2 stream.
+ */
+static int fastlz2_compress_high(const void* input, int prefix, int length, void* output) {
+  const uint8_t* ip_start = (const uint8_t*)input;
+  const uint8_t* ip_end = ip_start + prefix + length;
+  const uint8_t* ip_limit = ip_end - 12 - 1;
+  uint8_t* op = (uint8_t*)output;
+
+  flz_chain chain;
+  chain.start = ip_start;
+  chain.end = ip_end;
+  chain.head = (int32_t*)malloc(CHAIN_HASH_SIZE * sizeof(int32_t));
+  chain.prev = (int32_t*)malloc((prefix + length) * sizeof(int32_t));
+  chain.inserted = 0;
+
+  if (!chain.head || !chain.prev) {
+    free(chain.head);
+    free(chain.prev);
+    return fastlz2_compress_prefix(input, prefix, length, output);
+  }
+
+  for (int i = 0; i < CHAIN_HASH_SIZE; ++i) chain.head[i] = -1;
+
+  /* the prefix can be matched against, but isn't compressed */
+  const uint8_t* ip = ip_start + prefix;
+  flz_chain_update(&chain, ip);
+
+  /* we start with literal copy */
+  const uint8_t* anchor = ip;
+  ip += 2;
+
+  while (ip < ip_limit) {
+    uint32_t len = 0, distance = 0;
+
+    flz_chain_update(&chain, ip);
+    int32_t saved = flz_chain_find(&chain, ip, &len, &distance);
+    if (saved <= 0) {
+      ++ip;
+      continue;
+    }
+
+    /* lazy matching: defer to the next position while it saves more */
+    while (ip + 1 < ip_limit) {
+      uint32_t next_len = 0, next_distance = 0;
+
+      flz_chain_update(&chain, ip + 1);
+      int32_t next_saved = flz_chain_find(&chain, ip + 1, &next_len, &next_distance);
+      if (next_saved <= saved) break;
+
+      ++ip;
+      saved = next_saved;
+      len = next_len;
+      distance = next_distance;
+    }
+
+    if (ip > anchor) {
+      op = flz_literals(ip - anchor, anchor, op);
+    }
+
+    op = flz2_match(len - 2, distance, op);
+
+    ip += len;
+    anchor = ip;
+  }
+
+  op = flz_literals(ip_end - anchor, anchor, op);
+
+  /* marker for fastlz2 */
+  *(uint8_t*)output |= (1 << 5);
+
+  free(chain.head);
+  free(chain.prev);
+  return op - (uint8_t*)output;
+}
+
+#define WIDE_COPY 16
+
+/*
+ * Copies a match in 16 or 8-byte steps, so it may write up to WIDE_COPY - 1
+ * bytes past its end. Those are overwritten by the tokens that follow.
+ */
+static void flz_widecopy(uint8_t* op, const uint8_t* ref, uint32_t len) {
+  const uint8_t* end = op + len;
+  uint32_t distance = op - ref;
+  if (distance >= 16) {
+    do {
+      fastlz_memcpy(op, ref, 16);
+      op += 16;
+      ref += 16;
+    } while (op < end);
+  } else if (distance >= 8) {
+    do {
+      fastlz_memcpy(op, ref, 8);
+      op += 8;
+      ref += 8;
+    } while (op < end);
+  } else {
+    while (op < end) *op++ = *ref++;
+  }
+}
+
+/*
+ * Decompresses a stream made by fastlz2_compress_prefix, where dict holds
+ * the same prefix the stream was compressed against.
+ *
+ * Away from the end of both buffers literals and matches are copied in
+ * fixed-size steps, only the last few tokens are copied exactly.
+ */
+static int fastlz2_decompress_dict(const void* input, int length, void* output, int maxout, const void* dict,
+                                   int dict_len) {
   const uint8_t* ip = (const uint8_t*)input;
   const uint8_t* ip_limit = ip + length;
   const uint8_t* ip_bound = ip_limit - 2;
@@ -459,15 +653,33 @@ static int fastlz2_decompress(const void* input, int length, void* output, int m
           ref = op - ofs - MAX_L2_DISTANCE - 1;
         }
 
-      FASTLZ_BOUND_CHECK(op + len <= op_limit);
-      FASTLZ_BOUND_CHECK(ref >= (uint8_t*)output);
-      fastlz_memmove(op, ref, len);
+      if (FASTLZ_LIKELY(op + len + WIDE_COPY <= op_limit && ref >= (uint8_t*)output)) {
+        flz_widecopy(op, ref, len);
+      } else {
+        FASTLZ_BOUND_CHECK(op + len <= op_limit);
+        if (FASTLZ_UNLIKELY(ref < (uint8_t*)output)) {
+          /* match starts in the dictionary */
+          uint32_t back = (uint8_t*)output - ref;
+          uint32_t count = back < len ? back : len;
+          FASTLZ_BOUND_CHECK(back <= (uint32_t)dict_len);
+          fastlz_memcpy(op, (const uint8_t*)dict + dict_len - back, count);
+          op += count;
+          len -= count;
+          ref = (uint8_t*)output;
+        }
+        fastlz_memmove(op, ref, len);
+      }
       op += len;
     } else {
       ctrl++;
-      FASTLZ_BOUND_CHECK(op + ctrl <= op_limit);
-      FASTLZ_BOUND_CHECK(ip + ctrl <= ip_limit);
-      fastlz_memcpy(op, ip, ctrl);
+      if (FASTLZ_LIKELY(op + MAX_COPY <= op_limit && ip + MAX_COPY <= ip_limit)) {
+        /* literal runs are never longer than MAX_COPY */
+        fastlz_memcpy(op, ip, MAX_COPY);
+      } else {
+        FASTLZ_BOUND_CHECK(op + ctrl <= op_limit);
+        FASTLZ_BOUND_CHECK(ip + ctrl <= ip_limit);
+        fastlz_memcpy(op, ip, ctrl);
+      }
       ip += ctrl;
       op += ctrl;
     }
@@ -479,6 +691,10 @@ static int fastlz2_decompress(const void* input, int length, void* output, int m
   return op - (uint8_t*)output;
 }
 
+static int fastlz2_decompress(const void* input, int length, void* output, int maxout) {
+  return fastlz2_decompress_dict(input, length, output, maxout, 0, 0);
+}
+
 int fastlz_compress(const void* input, int length, void* output) {
   /* for short block, choose fastlz1 */
   if (length < 65536) return fastlz1_compress(input, length, output);
@@ -498,6 +714,16 @@ int fastlz_decompress(const void* input, int length, void* output, int maxout) {
   return 0;
 }
 
+int fastlz_decompress_dict(const void* input, int length, void* output, int maxout, const void* dict, int dict_len) {
+  /* dictionaries are only supported by level 2 streams */
+  int level = ((*(const uint8_t*)input) >> 5) + 1;
+
+  if (level == 2) return fastlz2_decompress_dict(input, length, output, maxout, dict, dict_len);
+  if (dict_len == 0) return fastlz_decompress(input, length, output, maxout);
+
+  return 0;
+}
+
 int fastlz_compress_level(int level, const void* input, int length, void* output) {
   if (level == 1) return fastlz1_compress(input, length, output);
   if (level == 2) return fastlz2_compress(input, length, output);
@@ -0,0 +1,343 @@
+// Copyright (c) 2024 Judah Caruso
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// canonical huffman coding of bytes, used after fastlz to squeeze out
+// what its byte-aligned output leaves behind. coded data (little-endian)
+// has the following structure:
+// decoded size (unsigned 32-bit integer)
+// code lengths (128-bytes, 4-bits per byte value, low bits first)
+// codes (lsb-first bitstream)
+
+#define HUFFMAN_MAX_BITS 11
+#define HUFFMAN_TABLE_SIZE (1 << HUFFMAN_MAX_BITS)
+#define HUFFMAN_HEADER_SIZE (4 + 128)
+#define HUFFMAN_ENCODE_OUT_SIZE(s) (HUFFMAN_HEADER_SIZE + (int)(((long long)(s) * HUFFMAN_MAX_BITS) / 8) + 8)
+
+typedef struct {
+   unsigned int freq;
+   int          parent;
+} HuffmanNode;
+
+// builds code lengths no longer than HUFFMAN_MAX_BITS, halving the
+// frequencies until the tree is shallow enough.
+static void
+HuffmanLengths(const unsigned int* counts, unsigned char* lengths)
+{
+   unsigned int freq[256];
+   memcpy(freq, counts, sizeof(freq));
+
+   while (true) {
+      memset(lengths, 0, 256);
+
+      // leaves sorted by frequency, then internal nodes in the order
+      // they're made, which is also sorted by frequency.
+      HuffmanNode nodes[512];
+      int symbols[256];
+      int leaves = 0;
+
+      for (int s = 0; s < 256; s += 1) {
+         if (freq[s] == 0)
+            { continue; }
+
+         int at = leaves;
+         while (at > 0 && nodes[at - 1].freq > freq[s]) {
+            nodes[at] = nodes[at - 1];
+            symbols[at] = symbols[at - 1];
+            at -= 1;
+         }
+
+         nodes[at].freq = freq[s];
+         nodes[at].parent = -1;
+         symbols[at] = s;
+         leaves += 1;
+      }
+
+      if (leaves == 0)
+         { return; }
+
+      if (leaves == 1) {
+         lengths[symbols[0]] = 1;
+         return;
+      }
+
+      int total = leaves;
+      int next_leaf = 0;
+      int next_node = leaves;
+
+      for (int i = 0; i < leaves - 1; i += 1) {
+         int pick[2];
+         for (int k = 0; k < 2; k += 1) {
+            if (next_node >= total || (next_leaf < leaves && nodes[next_leaf].freq <= nodes[next_node].freq))
+               { pick[k] = next_leaf++; }
+            else
+               { pick[k] = next_node++; }
+         }
+
+         nodes[total].freq = nodes[pick[0]].freq + nodes[pick[1]].freq;
+         nodes[total].parent = -1;
+         nodes[pick[0]].parent = total;
+         nodes[pick[1]].parent = total;
+         total += 1;
+      }
+
+      int max_bits = 0;
+      for (int i = 0; i < leaves; i += 1) {
+         int bits = 0;
+         for (int n = i; nodes[n].parent >= 0; n = nodes[n].parent)
+            { bits += 1; }
+
+         lengths[symbols[i]] = bits;
+         if (bits > max_bits)
+            { max_bits = bits; }
+      }
+
+      if (max_bits <= HUFFMAN_MAX_BITS)
+         { return; }
+
+      for (int s = 0; s < 256; s += 1) {
+         if (freq[s] > 0)
+            { freq[s] = (freq[s] >> 1) | 1; }
+      }
+   }
+}
+
+// assigns canonical codes, bit-reversed so they can be read lsb-first.
+// returns false if the lengths don't describe a valid code.
+static bool
+HuffmanCodes(const unsigned char* lengths, unsigned short* codes)
+{
+   int count[HUFFMAN_MAX_BITS + 1] = {0};
+   for (int s = 0; s < 256; s += 1)
+      { count[lengths[s]] += 1; }
+
+   count[0] = 0;
+
+   int next[HUFFMAN_MAX_BITS + 1] = {0};
+   int code = 0;
+   for (int bits = 1; bits <= HUFFMAN_MAX_BITS; bits += 1) {
+      code = (code + count[bits - 1]) << 1;
+      next[bits] = code;
+
+      if (next[bits] + count[bits] > (1 << bits))
+         { return false; }
+   }
+
+   for (int s = 0; s < 256; s += 1) {
+      int bits = lengths[s];
+      if (bits == 0)
+         { continue; }
+
+      int c = next[bits]++;
+      int reversed = 0;
+      for (int i = 0; i < bits; i += 1)
+         { reversed |= ((c >> i) & 1) << (bits - 1 - i); }
+
+      codes[s] = reversed;
+   }
+
+   return true;
+}
+
+// codes into out, which must hold HUFFMAN_ENCODE_OUT_SIZE bytes.
+// returns the coded size, or 0 if it couldn't be coded.
+static int
+HuffmanEncode(const char* in, int len, char* out)
+{
+   if (len <= 0)
+      { return 0; }
+
+   unsigned int counts[256] = {0};
+   for (int i = 0; i < len; i += 1)
+      { counts[(unsigned char)in[i]] += 1; }
+
+   unsigned char lengths[256];
+   unsigned short codes[256];
+   HuffmanLengths(counts, lengths);
+   if (!HuffmanCodes(lengths, codes))
+      { return 0; }
+
+   memcpy(&out[0], &len, 4);
+
+   for (int s = 0; s < 256; s += 2)
+      { out[4 + s / 2] = lengths[s] | (lengths[s + 1] << 4); }
+
+   int op = HUFFMAN_HEADER_SIZE;
+   unsigned long long bits = 0;
+   int count = 0;
+
+   for (int i = 0; i < len; i += 1) {
+      unsigned char s = in[i];
+      bits |= (unsigned long long)codes[s] << count;
+      count += lengths[s];
+
+      while (count >= 8) {
+         out[op++] = (char)bits;
+         bits >>= 8;
+         count -= 8;
+      }
+   }
+
+   if (count > 0)
+      { out[op++] = (char)bits; }
+
+   return op;
+}
+
+// each lookup decodes up to two symbols from the next HUFFMAN_MAX_BITS bits
+typedef struct {
+   unsigned char sym[2];
+   unsigned char first_bits; // bits used by the first symbol, 0 if invalid
+   unsigned char bits;       // bits used by both symbols, if there are two
+} HuffmanEntry;
+
+static int
+HuffmanDecodedSize(const char* in, int len)
+{
+   if (len < HUFFMAN_HEADER_SIZE)
+      { return -1; }
+
+   // every byte takes at least one bit
+   unsigned int size = 0;
+   memcpy(&size, in, 4);
+   if (size / 8 > (unsigned int)(len - HUFFMAN_HEADER_SIZE))
+      { return -1; }
+
+   return (int)size;
+}
+
+// decodes into out, which must hold HuffmanDecodedSize bytes
+static bool
+HuffmanDecode(const char* in, int len, char* out, int out_len)
+{
+   if (HuffmanDecodedSize(in, len) != out_len)
+      { return false; }
+
+   unsigned char lengths[256];
+   for (int s = 0; s < 256; s += 2) {
+      lengths[s]     = in[4 + s / 2] & 15;
+      lengths[s + 1] = (in[4 + s / 2] >> 4) & 15;
+   }
+
+   for (int s = 0; s < 256; s += 1) {
+      if (lengths[s] > HUFFMAN_MAX_BITS)
+         { return false; }
+   }
+
+   unsigned short codes[256];
+   if (!HuffmanCodes(lengths, codes))
+      { return false; }
+
+   HuffmanEntry table[HUFFMAN_TABLE_SIZE];
+   memset(table, 0, sizeof(table));
+
+   for (int s = 0; s < 256; s += 1) {
+      int bits = lengths[s];
+      if (bits == 0)
+         { continue; }
+
+      for (int i = codes[s]; i < HUFFMAN_TABLE_SIZE; i += 1 << bits) {
+         table[i].sym[0]     = s;
+         table[i].first_bits = bits;
+         table[i].bits       = bits;
+      }
+   }
+
+   // pair each entry with the symbol after it, if its code fits in the bits left
+   for (int i = 0; i < HUFFMAN_TABLE_SIZE; i += 1) {
+      int first = table[i].first_bits;
+      if (first == 0)
+         { continue; }
+
+      HuffmanEntry* next = &table[i >> first];
+      if (next->first_bits != 0 && first + next->first_bits <= HUFFMAN_MAX_BITS) {
+         table[i].sym[1] = next->sym[0];
+         table[i].bits   = first + next->first_bits;
+      }
+   }
+
+   const unsigned char* ip  = (const unsigned char*)in + HUFFMAN_HEADER_SIZE;
+   const unsigned char* end = (const unsigned char*)in + len;
+   unsigned char* op     = (unsigned char*)out;
+   unsigned char* op_end = op + out_len;
+
+   unsigned long long bits = 0;
+   int count = 0;
+   long long overrun = 0;
+
+   while (op < op_end) {
+      // refill to at least 56 bits, reading zeros past the end of the input
+      if (end - ip >= 8) {
+         unsigned long long next = 0;
+         memcpy(&next, ip, 8);
+         bits |= next << count;
+         ip += (63 - count) >> 3;
+         count |= 56;
+      }
+      else {
+         while (count <= 56) {
+            if (ip < end)
+               { bits |= (unsigned long long)*ip++ << count; }
+            else
+               { overrun += 8; }
+
+            count += 8;
+         }
+      }
+
+      // 56 bits are enough for four lookups. away from the end of the
+      // output both symbols are written and op only moves past the ones
+      // that were decoded.
+      if (op_end - op >= 8) {
+         for (int k = 0; k < 4; k += 1) {
+            HuffmanEntry e = table[bits & (HUFFMAN_TABLE_SIZE - 1)];
+            if (e.first_bits == 0)
+               { return false; }
+
+            op[0] = e.sym[0];
+            op[1] = e.sym[1];
+            op += 1 + (e.bits != e.first_bits);
+            bits >>= e.bits;
+            count -= e.bits;
+         }
+
+         continue;
+      }
+
+      for (int k = 0; k < 4 && op < op_end; k += 1) {
+         HuffmanEntry e = table[bits & (HUFFMAN_TABLE_SIZE - 1)];
+         if (e.first_bits == 0)
+            { return false; }
+
+         *op++ = e.sym[0];
+         if (e.bits != e.first_bits && op < op_end) {
+            *op++ = e.sym[1];
+            bits >>= e.bits;
+            count -= e.bits;
+         }
+         else {
+            bits >>= e.first_bits;
+            count -= e.first_bits;
+         }
+      }
+   }
+
+   // the codes can't have used more bits than there were
+   return count >= overrun;
+}
@@ -29,7 +29,7 @@ LuaBrutusReadall(lua_State* l)
 
    const char* path = lua_tostring(l, top);
 
-   char* data = ReadEntireFile(path);
+   char* data = ReadEntireFile(path, 0);
    if (!data) {
       lua_pushnil(l);
       return 1;
@@ -33,8 +33,10 @@ RunLoadTests()
       char* entry = datfiles[i];
 
       int out_len = 0;
-      char* chunk = LoadBrutFile(entry, &out_len);
-      if (!chunk || out_len == 0) {
+      const char* chunk = LoadBrutFile(entry, &out_len);
+
+      // make sure every other chunk in the file decodes as well
+      if (!chunk || out_len == 0 || !PreloadChunks(2, true)) {
          Log("%s fail", entry);
       }
       else {
@@ -67,63 +67,346 @@ BufPushLen(dyn_array_t(char)* buf, const char* str, int len)
    memcpy(stbds_arraddnptr(*buf, len), str, len);
 }
 
+// empties the buffer, keeping its memory
+static void
+BufClear(dyn_array_t(char)* buf)
+{
+   if (*buf)
+      { stbds_header(*buf)->length = 0; }
+}
+
 static void
 BufPush(dyn_array_t(char)* buf, const char* str)
 {
    BufPushLen(buf, str, strlen(str));
 }
 
-static char*
-Compress(const char* in, int len, int* out_len, bool* out_comp)
+// 64-bit fnv-1a, continuing from the given hash
+#define HASH_SEED 14695981039346656037ull
+
+static unsigned long long
+HashBytes(unsigned long long hash, const char* data, int len)
 {
-   if (len <= BRUT_FILE_MIN_COMPRESS_SIZE) {
-      *out_len  = len;
-      *out_comp = false;
-      return CopyString(in);
+   for (int i = 0; i < len; i += 1) {
+      hash ^= (unsigned char)data[i];
+      hash *= 1099511628211ull;
    }
 
-   int buf_len = (int)(((float)len) * 1.5f);
-   if (buf_len < 66) {
-      *out_len  = len;
-      *out_comp = false;
-      return CopyString(in);
+   return hash;
+}
+
+static unsigned short
+ReadU16(const char* ptr)
+{
+   unsigned short value = 0;
+   memcpy(&value, ptr, 2);
+   return value;
+}
+
+static unsigned int
+ReadU32(const char* ptr)
+{
+   unsigned int value = 0;
+   memcpy(&value, ptr, 4);
+   return value;
+}
+
+#define ARENA_BLOCK_SIZE (256 * 1024)
+
+// scratch memory that's handed out in order and released all at once,
+// for work that's thrown away after each file.
+typedef struct {
+   dyn_array_t(char*) blocks;
+   dyn_array_t(int)   sizes;
+   int                current; // block allocations come from
+   int                used;    // bytes used in the current block
+} Arena;
+
+static void*
+ArenaAlloc(Arena* arena, int size)
+{
+   size = (size + 15) & ~15;
+
+   while (arena->current < stbds_arrlen(arena->blocks)) {
+      if (size <= arena->sizes[arena->current] - arena->used) {
+         char* ptr = arena->blocks[arena->current] + arena->used;
+         arena->used += size;
+         return ptr;
+      }
+
+      arena->current += 1;
+      arena->used = 0;
+   }
+
+   int block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+   stbds_arrput(arena->blocks, malloc(block_size));
+   stbds_arrput(arena->sizes, block_size);
+
+   arena->used = size;
+   return arena->blocks[arena->current];
+}
+
+// frees everything allocated from the arena. if it took more than one
+// block, they're replaced by a single block as large as all of them,
+// so the next round of allocations doesn't need any new ones.
+static void
+ArenaReset(Arena* arena)
+{
+   int blocks = stbds_arrlen(arena->blocks);
+   if (blocks > 1) {
+      int total = 0;
+      for (int i = 0; i < blocks; i += 1) {
+         total += arena->sizes[i];
+         free(arena->blocks[i]);
+      }
+
+      stbds_arrsetlen(arena->blocks, 1);
+      stbds_arrsetlen(arena->sizes, 1);
+      arena->blocks[0] = malloc(total);
+      arena->sizes[0] = total;
+   }
+
+   arena->current = 0;
+   arena->used = 0;
+}
+
+static void
+ArenaFree(Arena* arena)
+{
+   for (int i = 0; i < stbds_arrlen(arena->blocks); i += 1)
+      { free(arena->blocks[i]); }
+
+   stbds_arrfree(arena->blocks);
+   stbds_arrfree(arena->sizes);
+   memset(arena, 0, sizeof(*arena));
+}
+
+// the most fastlz can expand its input
+#define COMPRESS_OUT_SIZE(s) ((s) + (s) / 2 + 66)
+
+// compresses with whichever fastlz level gives the smaller output, into a
+// buffer half again as large as the input and no smaller than 66 bytes.
+static int
+CompressSmallest(Arena* arena, const char* in, int len, char* out)
+{
+   int comp_len = fastlz2_compress_high(in, 0, len, out);
+
+   // level 1 is rarely smaller, but it decodes just as fast and costs
+   // little to try.
+   char* alt = ArenaAlloc(arena, COMPRESS_OUT_SIZE(len));
+   int alt_len = fastlz1_compress(in, len, alt);
+   if (alt_len < comp_len) {
+      memcpy(out, alt, alt_len);
+      comp_len = alt_len;
    }
 
-   char* buf = malloc(buf_len);
-   *out_len  = fastlz_compress_level(2, in, len, buf);
+   return comp_len;
+}
+
+// returns the input itself if it's stored as is
+static const char*
+Compress(Arena* arena, const char* in, int len, int* out_len, bool* out_comp)
+{
+   *out_len  = len;
+   *out_comp = false;
+
+   int buf_len = (int)(((float)len) * 1.5f);
+   if (len <= BRUT_FILE_MIN_COMPRESS_SIZE || buf_len < 66)
+      { return in; }
+
+   char* buf = ArenaAlloc(arena, buf_len);
+   int comp_len = CompressSmallest(arena, in, len, buf);
+
+   // stored as is if it didn't shrink
+   if (comp_len >= len)
+      { return in; }
+
+   *out_len  = comp_len;
    *out_comp = true;
    return buf;
 }
 
 static char*
-Decompress(const char* in, int len, int* out_len)
+CompressWithDictionary(Arena* arena, const char* in, int len, const char* dict, int dict_len, int* out_len)
 {
-   int maxlen = (int)(((float)len) * 3.5f); // @todo: way to calc this without being wasteful?
-   char* buf = malloc(maxlen);
-   memset(buf, 0, maxlen);
+   // fastlz matches against a prefix, so the dictionary
+   // and input are joined before compressing.
+   char* joined = ArenaAlloc(arena, dict_len + len);
+   memcpy(joined, dict, dict_len);
+   memcpy(joined + dict_len, in, len);
+
+   char* buf = ArenaAlloc(arena, COMPRESS_OUT_SIZE(len));
+   *out_len = fastlz2_compress_high(joined, dict_len, len, buf);
+   return buf;
+}
+
+static char*
+Decompress(const char* in, int len, int raw_len, const char* dict, int dict_len, int* out_len)
+{
+   // when the uncompressed size is known the chunk
+   // is decompressed straight into its final buffer.
+   if (raw_len > 0) {
+      char* buf = malloc(raw_len);
+      if (fastlz_decompress_dict(in, len, buf, raw_len, dict, dict_len) != raw_len) {
+         free(buf);
+         return 0;
+      }
+
+      *out_len = raw_len;
+      return buf;
+   }
+
+   // otherwise guess, growing the buffer until the chunk fits.
+   // fastlz can't expand a byte of input to more than 256 bytes,
+   // or write more than INT_MAX of them.
+   unsigned long long limit = (unsigned long long)len * 256;
+   if (limit > INT_MAX)
+      { limit = INT_MAX; }
+
+   unsigned long long maxlen = (unsigned long long)len * 4;
+   while (true) {
+      if (maxlen > limit)
+         { maxlen = limit; }
+
+      char* buf = malloc(maxlen);
+      if (!buf)
+         { return 0; }
+
+      int outlen = fastlz_decompress_dict(in, len, buf, (int)maxlen, dict, dict_len);
+      if (outlen > 0) {
+         *out_len = outlen;
+         return realloc(buf, outlen);
+      }
 
-   int outlen = fastlz_decompress(in, len, buf, maxlen);
-   if (outlen == 0) {
       free(buf);
-      return 0;
+
+      if (maxlen == limit)
+         { return 0; }
+
+      maxlen *= 2;
    }
+}
 
-   *out_len = outlen;
-   char* out = CopyStringLen(buf, outlen);
-   free(buf);
+#define DICT_KMER_SIZE 8
+#define DICT_SEGMENT_SIZE 64
 
-   return out;
+typedef struct {
+   int sample;
+   int offset;
+   int score;
+} DictSegment;
+
+static int
+CompareDictSegments(const void* a, const void* b)
+{
+   const DictSegment* x = a;
+   const DictSegment* y = b;
+
+   // best segments first, ties broken by position so the result is stable
+   if (x->score != y->score)
+      { return y->score - x->score; }
+
+   if (x->sample != y->sample)
+      { return x->sample - y->sample; }
+
+   return x->offset - y->offset;
 }
 
+// builds a dictionary out of the segments of each sample that share the
+// most 8-byte sequences with other samples. sequences that only repeat
+// within a single sample are ignored, as fastlz already finds those.
 static char*
-Encode(const char* in, int len, int* out_len)
+TrainDictionary(char** samples, int* lengths, int count, int max_len, int* out_len)
 {
-   int enc_len = BASE64_ENCODE_OUT_SIZE(len);
-   char* buf = malloc(enc_len);
-   memset(buf, 0, enc_len);
+   // the number of samples each sequence appears in
+   typedef struct { int samples; int last; } KmerInfo;
+   struct { unsigned long long key; KmerInfo value; }* kmers = 0;
 
-   *out_len = base64_encode((unsigned char *)in, len, buf);
-   return buf;
+   for (int s = 0; s < count; s += 1) {
+      for (int i = 0; i + DICT_KMER_SIZE <= lengths[s]; i += 1) {
+         unsigned long long key = 0;
+         memcpy(&key, &samples[s][i], DICT_KMER_SIZE);
+
+         ptrdiff_t at = stbds_hmgeti(kmers, key);
+         if (at < 0) {
+            KmerInfo info = { 1, s };
+            stbds_hmput(kmers, key, info);
+         }
+         else if (kmers[at].value.last != s) {
+            kmers[at].value.samples += 1;
+            kmers[at].value.last = s;
+         }
+      }
+   }
+
+   dyn_array_t(DictSegment) segments = 0;
+
+   for (int s = 0; s < count; s += 1) {
+      for (int off = 0; off + DICT_SEGMENT_SIZE <= lengths[s]; off += DICT_SEGMENT_SIZE) {
+         DictSegment seg = { s, off, 0 };
+         for (int i = 0; i + DICT_KMER_SIZE <= DICT_SEGMENT_SIZE; i += 1) {
+            unsigned long long key = 0;
+            memcpy(&key, &samples[s][off + i], DICT_KMER_SIZE);
+
+            int shared = stbds_hmget(kmers, key).samples;
+            if (shared > 1)
+               { seg.score += shared; }
+         }
+
+         if (seg.score > 0)
+            { stbds_arrput(segments, seg); }
+      }
+   }
+
+   if (segments)
+      { qsort(segments, stbds_arrlen(segments), sizeof(DictSegment), CompareDictSegments); }
+
+   // the best segments go at the end of the dictionary, closest to the
+   // data being compressed. sequences already in the dictionary don't
+   // count towards the segments picked after them.
+   int dict_len = 0;
+   char* dict = malloc(max_len);
+
+   for (int i = 0; i < stbds_arrlen(segments) && dict_len + DICT_SEGMENT_SIZE <= max_len; i += 1) {
+      const char* data = &samples[segments[i].sample][segments[i].offset];
+
+      int score = 0;
+      for (int k = 0; k + DICT_KMER_SIZE <= DICT_SEGMENT_SIZE; k += 1) {
+         unsigned long long key = 0;
+         memcpy(&key, &data[k], DICT_KMER_SIZE);
+
+         int shared = stbds_hmget(kmers, key).samples;
+         if (shared > 1)
+            { score += shared; }
+      }
+
+      if (score * 2 < segments[i].score)
+         { continue; }
+
+      for (int k = 0; k + DICT_KMER_SIZE <= DICT_SEGMENT_SIZE; k += 1) {
+         unsigned long long key = 0;
+         memcpy(&key, &data[k], DICT_KMER_SIZE);
+
+         KmerInfo used = { 0, -1 };
+         stbds_hmput(kmers, key, used);
+      }
+
+      dict_len += DICT_SEGMENT_SIZE;
+      memcpy(&dict[max_len - dict_len], data, DICT_SEGMENT_SIZE);
+   }
+
+   stbds_arrfree(segments);
+   stbds_hmfree(kmers);
+
+   if (dict_len == 0) {
+      free(dict);
+      return 0;
+   }
+
+   memmove(dict, &dict[max_len - dict_len], dict_len);
+
+   *out_len = dict_len;
+   return dict;
 }
 
 static char*
@@ -131,8 +414,6 @@ Decode(const char* in, int len, int* out_len)
 {
    int dec_len = BASE64_DECODE_OUT_SIZE(len);
    char* buf = malloc(dec_len);
-   memset(buf, 0, dec_len);
-
    *out_len = base64_decode(in, len, (unsigned char *)buf);
    return buf;
 }
@@ -147,6 +428,16 @@ SetWorkingDirectory(const char* path)
 #endif
 }
 
+static bool
+MakeExecutable(const char* path)
+{
+#if defined(PLATFORM_WINDOWS)
+   return true;
+#else
+   return chmod(path, 0755) == 0;
+#endif
+}
+
 static char*
 GetExePath()
 {
@@ -178,6 +469,427 @@ GetExePath()
 #endif
 }
 
+#if defined(PLATFORM_WINDOWS)
+   typedef HANDLE Thread;
+   typedef SRWLOCK Mutex;
+   typedef CONDITION_VARIABLE Cond;
+
+   #define MUTEX_INIT SRWLOCK_INIT
+   #define COND_INIT CONDITION_VARIABLE_INIT
+#else
+   typedef pthread_t Thread;
+   typedef pthread_mutex_t Mutex;
+   typedef pthread_cond_t Cond;
+
+   #define MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+   #define COND_INIT PTHREAD_COND_INITIALIZER
+#endif
+
+typedef void (*ThreadProc)(void*);
+
+typedef struct {
+   ThreadProc proc;
+   void*      data;
+} ThreadStart;
+
+#if defined(PLATFORM_WINDOWS)
+static DWORD WINAPI
+ThreadEntry(void* ptr)
+#else
+static void*
+ThreadEntry(void* ptr)
+#endif
+{
+   ThreadStart start = *(ThreadStart*)ptr;
+   free(ptr);
+
+   start.proc(start.data);
+   return 0;
+}
+
+static bool
+StartThread(Thread* out_thread, ThreadProc proc, void* data)
+{
+   ThreadStart* start = malloc(sizeof(ThreadStart));
+   start->proc = proc;
+   start->data = data;
+
+#if defined(PLATFORM_WINDOWS)
+   *out_thread = CreateThread(0, 0, ThreadEntry, start, 0, 0);
+   if (*out_thread)
+      { return true; }
+#else
+   if (pthread_create(out_thread, 0, ThreadEntry, start) == 0)
+      { return true; }
+#endif
+
+   free(start);
+   return false;
+}
+
+static void
+JoinThread(Thread thread)
+{
+#if defined(PLATFORM_WINDOWS)
+   WaitForSingleObject(thread, INFINITE);
+   CloseHandle(thread);
+#else
+   pthread_join(thread, 0);
+#endif
+}
+
+static void
+DetachThread(Thread thread)
+{
+#if defined(PLATFORM_WINDOWS)
+   CloseHandle(thread);
+#else
+   pthread_detach(thread);
+#endif
+}
+
+static void
+LockMutex(Mutex* mutex)
+{
+#if defined(PLATFORM_WINDOWS)
+   AcquireSRWLockExclusive(mutex);
+#else
+   pthread_mutex_lock(mutex);
+#endif
+}
+
+static void
+UnlockMutex(Mutex* mutex)
+{
+#if defined(PLATFORM_WINDOWS)
+   ReleaseSRWLockExclusive(mutex);
+#else
+   pthread_mutex_unlock(mutex);
+#endif
+}
+
+static void
+WaitCond(Cond* cond, Mutex* mutex)
+{
+#if defined(PLATFORM_WINDOWS)
+   SleepConditionVariableSRW(cond, mutex, INFINITE, 0);
+#else
+   pthread_cond_wait(cond, mutex);
+#endif
+}
+
+static void
+BroadcastCond(Cond* cond)
+{
+#if defined(PLATFORM_WINDOWS)
+   WakeAllConditionVariable(cond);
+#else
+   pthread_cond_broadcast(cond);
+#endif
+}
+
+static int
+GetProcessorCount(void)
+{
+#if defined(PLATFORM_WINDOWS)
+   SYSTEM_INFO info;
+   GetSystemInfo(&info);
+   return info.dwNumberOfProcessors;
+#else
+   long count = sysconf(_SC_NPROCESSORS_ONLN);
+   return count > 0 ? count : 1;
+#endif
+}
+
+// worker is a number below the thread count, only used by one thread
+typedef void (*ParallelProc)(void* data, int i, int worker);
+
+typedef struct {
+   ParallelProc proc;
+   void*        data;
+   int          count;
+   int          next;
+   int          workers;
+   Mutex        lock;
+} ParallelJob;
+
+static void
+ParallelWorker(void* ptr)
+{
+   ParallelJob* job = ptr;
+
+   LockMutex(&job->lock);
+   int worker = job->workers;
+   job->workers += 1;
+   UnlockMutex(&job->lock);
+
+   while (true) {
+      LockMutex(&job->lock);
+      int i = job->next;
+      job->next += 1;
+      UnlockMutex(&job->lock);
+
+      if (i >= job->count)
+         { break; }
+
+      job->proc(job->data, i, worker);
+   }
+}
+
+// calls proc for every index up to count on at most the given number
+// of threads, including the calling one. returns once all calls are done.
+static void
+ParallelFor(int count, int threads, ParallelProc proc, void* data)
+{
+   ParallelJob job = { proc, data, count, 0, 0, MUTEX_INIT };
+
+   dyn_array_t(Thread) workers = 0;
+   for (int i = 1; i < threads && i < count; i += 1) {
+      Thread thread;
+      if (!StartThread(&thread, ParallelWorker, &job))
+         { break; }
+
+      stbds_arrput(workers, thread);
+   }
+
+   ParallelWorker(&job);
+
+   for (int i = 0; i < stbds_arrlen(workers); i += 1)
+      { JoinThread(workers[i]); }
+
+   stbds_arrfree(workers);
+}
+
+typedef struct {
+   const char* in;
+   int         len;
+   int         block_size;
+   const char* dict;
+   int         dict_len;
+   Arena*      arenas; // one for each worker
+   char**      blocks;
+   int*        lengths;
+} CompressJob;
+
+static void
+CompressBlock(void* data, int i, int worker)
+{
+   CompressJob* job = data;
+   Arena* arena = &job->arenas[worker];
+
+   const char* in = job->in + i * job->block_size;
+   int len = job->len - i * job->block_size;
+   if (len > job->block_size)
+      { len = job->block_size; }
+
+   if (job->dict_len > 0) {
+      job->blocks[i] = CompressWithDictionary(arena, in, len, job->dict, job->dict_len, &job->lengths[i]);
+   }
+   else {
+      job->blocks[i] = ArenaAlloc(arena, COMPRESS_OUT_SIZE(len));
+      job->lengths[i] = CompressSmallest(arena, in, len, job->blocks[i]);
+   }
+}
+
+// splits the input into blocks that are compressed independently, so
+// large chunks can be compressed and decompressed on several threads.
+// the output starts with a table of the blocks:
+// block size (unsigned 32-bit integer, uncompressed)
+// block count (unsigned 32-bit integer)
+// compressed size of each block (unsigned 32-bit integers)
+// followed by every compressed block.
+static char*
+CompressBlocks(Arena* arena, const char* in, int len, int block_size, const char* dict, int dict_len, int threads, int* out_len)
+{
+   int count = (len + block_size - 1) / block_size;
+
+   CompressJob job = {0};
+   job.in         = in;
+   job.len        = len;
+   job.block_size = block_size;
+   job.dict       = dict;
+   job.dict_len   = dict_len;
+   job.arenas     = calloc(threads, sizeof(Arena));
+   job.blocks     = malloc(count * sizeof(char*));
+   job.lengths    = malloc(count * sizeof(int));
+
+   ParallelFor(count, threads, CompressBlock, &job);
+
+   int total = 8 + count * 4;
+   for (int i = 0; i < count; i += 1)
+      { total += job.lengths[i]; }
+
+   char* out = ArenaAlloc(arena, total);
+   memcpy(&out[0], &block_size, 4);
+   memcpy(&out[4], &count, 4);
+   memcpy(&out[8], job.lengths, count * 4);
+
+   int off = 8 + count * 4;
+   for (int i = 0; i < count; i += 1) {
+      memcpy(&out[off], job.blocks[i], job.lengths[i]);
+      off += job.lengths[i];
+   }
+
+   for (int i = 0; i < threads; i += 1)
+      { ArenaFree(&job.arenas[i]); }
+
+   free(job.arenas);
+   free(job.blocks);
+   free(job.lengths);
+
+   *out_len = total;
+   return out;
+}
+
+// huffman codes every block in the output of CompressBlocks
+static char*
+EntropyCodeBlocks(Arena* arena, const char* in, int len, int* out_len)
+{
+   unsigned int count = ReadU32(&in[4]);
+
+   dyn_array_t(char*) blocks  = 0;
+   dyn_array_t(int)   lengths = 0;
+
+   int total = 8 + count * 4;
+   unsigned int off = 8 + count * 4;
+
+   for (unsigned int i = 0; i < count; i += 1) {
+      int block_len = ReadU32(&in[8 + i * 4]);
+
+      char* coded = ArenaAlloc(arena, HUFFMAN_ENCODE_OUT_SIZE(block_len));
+      int coded_len = HuffmanEncode(&in[off], block_len, coded);
+      off += block_len;
+
+      stbds_arrput(blocks, coded);
+      stbds_arrput(lengths, coded_len);
+      total += coded_len;
+   }
+
+   char* out = ArenaAlloc(arena, total);
+   memcpy(&out[0], &in[0], 8);
+   memcpy(&out[8], lengths, count * 4);
+
+   off = 8 + count * 4;
+   for (unsigned int i = 0; i < count; i += 1) {
+      memcpy(&out[off], blocks[i], lengths[i]);
+      off += lengths[i];
+   }
+
+   stbds_arrfree(blocks);
+   stbds_arrfree(lengths);
+
+   *out_len = total;
+   return out;
+}
+
+typedef struct {
+   const char* in;
+   char*       out;
+   int         raw_len;
+   int         block_size;
+   const char* dict;
+   int         dict_len;
+   bool        entropy;
+   int*        offsets;
+   int*        lengths;
+   bool*       failed;
+} DecompressJob;
+
+static void
+DecompressBlock(void* data, int i, int worker)
+{
+   DecompressJob* job = data;
+
+   int raw_len = job->raw_len - i * job->block_size;
+   if (raw_len > job->block_size)
+      { raw_len = job->block_size; }
+
+   const char* in = job->in + job->offsets[i];
+   int in_len = job->lengths[i];
+
+   // entropy coded blocks are decoded before they're decompressed
+   char* decoded = 0;
+   if (job->entropy) {
+      int decoded_len = HuffmanDecodedSize(in, in_len);
+      decoded = decoded_len > 0 ? malloc(decoded_len) : 0;
+      if (!decoded || !HuffmanDecode(in, in_len, decoded, decoded_len)) {
+         free(decoded);
+         job->failed[i] = true;
+         return;
+      }
+
+      in = decoded;
+      in_len = decoded_len;
+   }
+
+   char* out = job->out + i * job->block_size;
+   int len = fastlz_decompress_dict(in, in_len, out, raw_len, job->dict, job->dict_len);
+   job->failed[i] = len != raw_len;
+
+   free(decoded);
+}
+
+// decompresses the output of CompressBlocks, or EntropyCodeBlocks if
+// entropy is set, on at most the given number of threads.
+static char*
+DecompressBlocks(const char* in, int len, int raw_len, const char* dict, int dict_len, bool entropy, int threads, int* out_len)
+{
+   if (len < 8 || raw_len <= 0)
+      { return 0; }
+
+   unsigned int block_size = ReadU32(&in[0]);
+   unsigned int count = ReadU32(&in[4]);
+   if (block_size == 0 || count != (raw_len + block_size - 1) / block_size || count > (unsigned int)(len - 8) / 4)
+      { return 0; }
+
+   DecompressJob job = {0};
+   job.in         = in;
+   job.out        = malloc(raw_len);
+   job.raw_len    = raw_len;
+   job.block_size = block_size;
+   job.dict       = dict;
+   job.dict_len   = dict_len;
+   job.entropy    = entropy;
+   job.offsets    = malloc(count * sizeof(int));
+   job.lengths    = malloc(count * sizeof(int));
+   job.failed     = malloc(count * sizeof(bool));
+
+   bool ok = true;
+
+   unsigned int off = 8 + count * 4;
+   for (unsigned int i = 0; i < count; i += 1) {
+      unsigned int block_len = ReadU32(&in[8 + i * 4]);
+      if (block_len > len - off) {
+         ok = false;
+         break;
+      }
+
+      job.offsets[i] = off;
+      job.lengths[i] = block_len;
+      off += block_len;
+   }
+
+   if (ok)
+      { ParallelFor(count, threads, DecompressBlock, &job); }
+
+   for (unsigned int i = 0; ok && i < count; i += 1) {
+      if (job.failed[i])
+         { ok = false; }
+   }
+
+   free(job.offsets);
+   free(job.lengths);
+   free(job.failed);
+
+   if (!ok) {
+      free(job.out);
+      return 0;
+   }
+
+   *out_len = raw_len;
+   return job.out;
+}
+
 static bool
 ListDirectory(const char* path, dyn_array_t(char*)* out_entries)
 {
@@ -194,6 +906,8 @@ ListDirectory(const char* path, dyn_array_t(char*)* out_entries)
 
       stbds_arrput(*out_entries, CopyString(fd.cFileName));
    } while (FindNextFileA(h, &fd));
+
+   FindClose(h);
 #else
    DIR* dir = opendir(path);
    if (!dir)
@@ -203,6 +917,8 @@ ListDirectory(const char* path, dyn_array_t(char*)* out_entries)
    while ((ent = readdir(dir)) != 0) {
       stbds_arrput(*out_entries, CopyString(ent->d_name));
    }
+
+   closedir(dir);
 #endif
 
    return true;
@@ -216,7 +932,7 @@ FileExists(const char* path)
 }
 
 static char*
-ReadEntireFile(const char* path)
+ReadEntireFile(const char* path, int* out_len)
 {
    HANDLE fh = CreateFileA(path, FILE_GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
    if (fh == INVALID_HANDLE_VALUE)
@@ -241,9 +957,48 @@ ReadEntireFile(const char* path)
    buf[length] = '\0';
    CloseHandle(fh);
 
+   if (out_len)
+      { *out_len = length; }
+
    return buf;
 }
 
+// maps a file read-only for the lifetime of the process.
+static const char*
+MapEntireFile(const char* path, int* out_len)
+{
+   HANDLE fh = CreateFileA(path, FILE_GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
+   if (fh == INVALID_HANDLE_VALUE)
+      { return 0; }
+
+   LARGE_INTEGER size = {0};
+   if (!GetFileSizeEx(fh, &size) || size.QuadPart == 0) {
+      CloseHandle(fh);
+      return 0;
+   }
+
+   HANDLE mh = CreateFileMappingA(fh, 0, PAGE_READONLY, 0, 0, 0);
+   CloseHandle(fh);
+
+   if (!mh)
+      { return 0; }
+
+   const char* data = MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0);
+   CloseHandle(mh);
+
+   if (!data)
+      { return 0; }
+
+   *out_len = (int)size.QuadPart;
+   return data;
+}
+
+static void
+UnmapEntireFile(const char* data, int len)
+{
+   UnmapViewOfFile(data);
+}
+
 static bool
 WriteEntireFile(const char* path, const char* data, size_t len)
 {
@@ -257,9 +1012,57 @@ WriteEntireFile(const char* path, const char* data, size_t len)
       return false;
    }
 
+   CloseHandle(fh);
+   return true;
+}
+
+// succeeds if the directory already exists
+static bool
+MakeDirectory(const char* path)
+{
+   return CreateDirectoryA(path, 0) || GetLastError() == ERROR_ALREADY_EXISTS;
+}
+
+// replaces the file at 'to' if there is one
+static bool
+RenameFile(const char* from, const char* to)
+{
+   return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING);
+}
+
+// seconds since the unix epoch
+static bool
+GetModifiedTime(const char* path, long long* out_time)
+{
+   WIN32_FILE_ATTRIBUTE_DATA data = {0};
+   if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data))
+      { return false; }
+
+   ULARGE_INTEGER time = {0};
+   time.LowPart  = data.ftLastWriteTime.dwLowDateTime;
+   time.HighPart = data.ftLastWriteTime.dwHighDateTime;
+
+   // file times are in 100ns steps since 1601
+   *out_time = (long long)(time.QuadPart / 10000000ull) - 11644473600ll;
    return true;
 }
 
+// sets the modified time of a file to now
+static bool
+TouchFile(const char* path)
+{
+   HANDLE fh = CreateFileA(path, FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ|FILE_SHARE_WRITE, 0, OPEN_EXISTING, 0, 0);
+   if (fh == INVALID_HANDLE_VALUE)
+      { return false; }
+
+   FILETIME now = {0};
+   GetSystemTimeAsFileTime(&now);
+
+   bool ok = SetFileTime(fh, 0, 0, &now);
+   CloseHandle(fh);
+   return ok;
+}
+
 #else
 
 static bool
@@ -272,9 +1075,9 @@ FileExists(const char* path)
 }
 
 static char*
-ReadEntireFile(const char* path)
+ReadEntireFile(const char* path, int* out_len)
 {
-   FILE* file = fopen(path, "r");
+   FILE* file = fopen(path, "rb");
    if (!file)
       { goto failure; }
 
@@ -301,6 +1104,9 @@ ReadEntireFile(const char* path)
    data[len] = '\0';
    fclose(file);
 
+   if (out_len)
+      { *out_len = len; }
+
    return data;
 
 failure:
@@ -309,6 +1115,36 @@ failure:
    return 0;
 }
 
+// maps a file read-only for the lifetime of the process.
+static const char*
+MapEntireFile(const char* path, int* out_len)
+{
+   int fd = open(path, O_RDONLY);
+   if (fd == -1)
+      { return 0; }
+
+   struct stat st;
+   if (fstat(fd, &st) != 0 || st.st_size == 0) {
+      close(fd);
+      return 0;
+   }
+
+   void* data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+
+   if (data == MAP_FAILED)
+      { return 0; }
+
+   *out_len = (int)st.st_size;
+   return data;
+}
+
+static void
+UnmapEntireFile(const char* data, int len)
+{
+   munmap((void *)data, len);
+}
+
 static bool
 WriteEntireFile(const char* path, const char* data, size_t len)
 {
@@ -322,4 +1158,97 @@ WriteEntireFile(const char* path, const char* data, size_t len)
    return written == len;
 }
 
+// succeeds if the directory already exists
+static bool
+MakeDirectory(const char* path)
+{
+   return mkdir(path, 0755) == 0 || errno == EEXIST;
+}
+
+// replaces the file at 'to' if there is one
+static bool
+RenameFile(const char* from, const char* to)
+{
+   return rename(from, to) == 0;
+}
+
+// seconds since the unix epoch
+static bool
+GetModifiedTime(const char* path, long long* out_time)
+{
+   struct stat st;
+   if (stat(path, &st) != 0)
+      { return false; }
+
+   *out_time = st.st_mtime;
+   return true;
+}
+
+// sets the modified time of a file to now
+static bool
+TouchFile(const char* path)
+{
+   return utime(path, 0) == 0;
+}
+
 #endif
+
+// a file that's written front to back as its parts are ready, with the
+// parts that weren't known yet patched in afterwards. the first error
+// is kept until it's closed.
+typedef struct {
+   FILE*        file;
+   unsigned int len;
+   bool         failed;
+} OutputFile;
+
+static bool
+OpenOutputFile(OutputFile* out, const char* path)
+{
+   out->file   = fopen(path, "wb");
+   out->len    = 0;
+   out->failed = !out->file;
+   return out->file != 0;
+}
+
+static void
+WriteOutput(OutputFile* out, const char* data, unsigned int len)
+{
+   if (!out->failed && fwrite(data, 1, len, out->file) != len)
+      { out->failed = true; }
+
+   out->len += len;
+}
+
+// pads the file with zeros up to len bytes
+static void
+PadOutput(OutputFile* out, unsigned int len)
+{
+   static const char zeros[4096];
+   while (out->len < len) {
+      unsigned int n = len - out->len;
+      WriteOutput(out, zeros, n < sizeof(zeros) ? n : sizeof(zeros));
+   }
+}
+
+// overwrites what was written at offset, later writes still go to the end
+static void
+PatchOutput(OutputFile* out, unsigned int offset, const char* data, unsigned int len)
+{
+   if (out->failed)
+      { return; }
+
+   if (fseek(out->file, offset, SEEK_SET) != 0 || fwrite(data, 1, len, out->file) != len || fseek(out->file, 0, SEEK_END) != 0)
+      { out->failed = true; }
+}
+
+// returns false if anything written to the file was lost
+static bool
+CloseOutputFile(OutputFile* out)
+{
+   if (out->file && fclose(out->file) != 0)
+      { out->failed = true; }
+
+   out->file = 0;
+   return !out->failed;
+}